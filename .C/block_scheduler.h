@@ -0,0 +1,198 @@
+/**
+   lassosum
+   block_scheduler.h
+   Purpose: solve the independent blocks of repelnet on a pool of threads
+
+   The blocks of repelnet share nothing but read-only data, so they can be
+   solved concurrently. R is single threaded: the worker threads never call
+   into R, and the main thread is left to print the trace and to poll for
+   user interrupts while the workers run.
+
+ */
+#ifndef LASSOSUM_BLOCK_SCHEDULER_H
+#define LASSOSUM_BLOCK_SCHEDULER_H
+
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <exception>
+#include <condition_variable>
+#include <RcppArmadillo.h>
+
+/**
+   Checks for a user interrupt without unwinding the stack
+
+   R_CheckUserInterrupt longjmps on an interrupt, which must not happen while
+   worker threads are running; R_ToplevelExec catches the jump for us.
+
+   @return true if the user has interrupted
+
+ */
+static void checkInterruptFn(void*) {
+  R_CheckUserInterrupt();
+}
+
+inline bool pendingInterrupt() {
+  return (R_ToplevelExec(checkInterruptFn, NULL) == FALSE);
+}
+
+/**
+   Orders the blocks by decreasing size
+
+   Blocks are handed out from this order, so the largest blocks start first
+   and the small ones fill in the gaps at the end, which keeps the tail short.
+
+   @startvec first column of each block
+   @endvec last column of each block
+   @return block indices, largest block first
+
+ */
+inline std::vector<int> blocksLargestFirst(const arma::Col<int>& startvec,
+                                           const arma::Col<int>& endvec) {
+  std::vector<int> order(startvec.n_elem);
+  for(int i=0; i < startvec.n_elem; i++) order[i]=i;
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+    return endvec(a) - startvec(a) > endvec(b) - startvec(b);
+  });
+  return order;
+}
+
+/**
+   Runs solve(i, thread, abort) for every block i on nthreads worker threads
+
+   The workers take the next block of order from a shared counter: as every
+   block is known in advance and no block spawns more work, this is what
+   work stealing reduces to, without the per-thread queues. thread (in
+   0..nthreads-1) identifies the worker, e.g. to pick its scratch memory.
+   solve must not call R, and should return early once abort is set.
+
+   @nblocks number of blocks
+   @order the order in which blocks are handed out
+   @nthreads number of worker threads
+   @trace if > 0, the main thread reports each block as it finishes
+   @solve the function solving one block
+
+ */
+template <class Solve>
+void runBlocks(int nblocks, const std::vector<int>& order, int nthreads,
+               int trace, Solve solve) {
+
+  std::atomic<int> next(0);
+  std::atomic<int> running(nthreads);
+  std::atomic<bool> abort(false);
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::vector<int> done;
+  done.reserve(nblocks);
+  std::exception_ptr error;
+
+  auto worker = [&](int thread) {
+    for(;;) {
+      if(abort.load()) break;
+      int t = next++;
+      if(t >= nblocks) break;
+      try {
+        solve(order[t], thread, abort);
+      } catch(...) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if(!error) error = std::current_exception();
+        abort = true;
+      }
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        done.push_back(order[t]);
+      }
+      cv.notify_one();
+    }
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      running--;
+    }
+    cv.notify_one();
+  };
+
+  std::vector<std::thread> threads;
+  for(int i=0; i < nthreads; i++) threads.push_back(std::thread(worker, i));
+
+  // The main thread only reports progress and watches for interrupts
+  bool interrupted = false;
+  size_t reported = 0;
+  for(;;) {
+    std::vector<int> finished;
+    bool alldone;
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      cv.wait_for(lock, std::chrono::milliseconds(100));
+      finished.assign(done.begin() + reported, done.end());
+      reported = done.size();
+      alldone = (running.load() == 0);
+    }
+    if(trace > 0) {
+      for(size_t i=0; i < finished.size(); i++)
+        Rcpp::Rcout << "Block: " << finished[i] << "\n";
+    }
+    if(alldone) break;
+    if(!interrupted && pendingInterrupt()) {
+      interrupted = true;
+      abort = true;
+    }
+  }
+  for(size_t i=0; i < threads.size(); i++) threads[i].join();
+
+  if(error) std::rethrow_exception(error);
+  if(interrupted) throw Rcpp::internal::InterruptedException();
+}
+
+/**
+   Solves the blocks i for which marked(i) is true
+
+   With nthreads > 1 and more than one task, the tasks are handed out to
+   runBlocks, largest block first. Otherwise they are solved one after the
+   other on the calling thread, in block order, without allocating: solve
+   then receives abort, which is not NULL when the calling thread is itself a
+   worker (see repelnetCore), and the blocks are reported as they finish.
+
+   @startvec first column of each block
+   @endvec last column of each block
+   @marked whether a block is to be solved
+   @nthreads number of worker threads
+   @trace if > 0, each block is reported as it finishes
+   @abort as in repelnetCore
+   @solve the function solving task t: solve(t, thread, abort)
+   @tasks the number of tasks of each block, task tasks*i+k being part k of
+   block i; runBlocks then reports no block
+
+ */
+template <class Marked, class Solve>
+void runMarkedBlocks(const arma::Col<int>& startvec, const arma::Col<int>& endvec,
+                     Marked marked, int nthreads, int trace, const std::atomic<bool>* abort,
+                     Solve solve, int tasks = 1) {
+  int nblocks = startvec.n_elem;
+  int i, k, nmarked = 0;
+  for(i=0; i < nblocks; i++)
+    if(marked(i)) nmarked++;
+
+  if(nthreads > 1 && nmarked * tasks > 1) {
+    std::vector<int> order;
+    std::vector<int> bysize = blocksLargestFirst(startvec, endvec);
+    for(size_t t=0; t < bysize.size(); t++)
+      if(marked(bysize[t]))
+        for(k=0; k < tasks; k++) order.push_back(tasks*bysize[t]+k);
+    runBlocks(order.size(), order, nthreads, tasks == 1 ? trace : 0,
+              [&](int t, int thread, const std::atomic<bool>& abort) {
+      solve(t, thread, &abort);
+    });
+  } else {
+    for(i=0; i < nblocks; i++) {
+      if(!marked(i)) continue;
+      for(k=0; k < tasks; k++) solve(tasks*i+k, 0, abort);
+      if(abort != NULL && abort->load()) return;
+      if(trace > 0 && abort == NULL) Rcpp::Rcout << "Block: " << i << "\n";
+    }
+  }
+}
+
+#endif
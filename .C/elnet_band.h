@@ -0,0 +1,197 @@
+/**
+   lassosum
+   elnet_band.h
+   Purpose: solve elnet over a whole chromosome on a banded LD matrix
+
+   LD decays with distance: the correlation of two SNPs far apart is close
+   to zero. Restricting the LD matrix R = G'G to the pairs of SNPs within a
+   window of each other, and dropping the small correlations left, gives a
+   sparse banded matrix whose size grows linearly with the number of SNPs,
+   and needs no blocks.
+
+   elnet only sees the genotypes through t(X[,q*j+k])*X[,q*l+k], which is
+   (1 - shrink)*R(j,l) for the standardized genotypes scaled as in runElnet:
+   the coordinate descent is run on R instead, keeping Rx = (R (x) I_q) x up
+   to date in place of yhat = X*x. An update then costs the number of SNPs
+   within the window of the SNP, rather than the number of subjects.
+
+ */
+#ifndef LASSOSUM_ELNET_BAND_H
+#define LASSOSUM_ELNET_BAND_H
+
+#include <vector>
+#include <atomic>
+#include <cmath>
+#include <algorithm>
+#include <RcppArmadillo.h>
+#include "block_scheduler.h"
+#include "elnet_workspace.h"
+
+/**
+   Computes the banded LD matrix of G
+
+   @G the standardized genotypes (n x p)
+   @windowend the last SNP within the window of each SNP, windowend(j) >= j
+   @ldthr the correlations below ldthr in absolute value are dropped (the
+   diagonal is always kept)
+   @nthreads number of threads
+   @return R(j,l) = t(G[,j])*G[,l] for the SNPs within the window of each
+   other, as a symmetric p x p sparse matrix
+
+ */
+inline arma::sp_mat bandedLD(const arma::mat& G, const arma::Col<int>& windowend, double ldthr,
+                             int nthreads) {
+  int p = G.n_cols, n = G.n_rows;
+  int j, l;
+
+  // Column j of the upper triangle, computed by task j
+  std::vector<std::vector<int> > rows(p);
+  std::vector<std::vector<double> > values(p);
+  auto column = [&](int j) {
+    arma::vec gj(const_cast<double*>(G.colptr(j)), n, false, true);
+    for(int l=j; l <= windowend(j) && l < p; l++) {
+      double v = colDot(G, l, gj);
+      if(l > j && std::abs(v) < ldthr) continue;
+      rows[j].push_back(l);
+      values[j].push_back(v);
+    }
+  };
+  std::vector<int> order(p);
+  for(j=0; j < p; j++) order[j] = j;
+  if(nthreads > 1 && p > 1) {
+    runBlocks(p, order, nthreads, 0, [&](int j, int thread, const std::atomic<bool>& abort) {
+      column(j);
+    });
+  } else {
+    for(j=0; j < p; j++) column(j);
+  }
+
+  // The symmetric matrix in compressed sparse column form: column j holds the
+  // entries (l, j) of the columns l < j, then its own, so that its rows are
+  // in increasing order
+  arma::uvec colptr(p + 1, arma::fill::zeros);
+  for(j=0; j < p; j++) {
+    colptr(j+1) += rows[j].size();
+    for(size_t t=1; t < rows[j].size(); t++) colptr(rows[j][t]+1)++;
+  }
+  for(j=0; j < p; j++) colptr(j+1) += colptr(j);
+  arma::uvec rowind(colptr(p));
+  arma::vec nonzero(colptr(p));
+  std::vector<arma::uword> pos(p);
+  for(j=0; j < p; j++) pos[j] = colptr(j);
+  for(j=0; j < p; j++) {
+    for(size_t t=0; t < rows[j].size(); t++) {
+      rowind(pos[j]) = rows[j][t];
+      nonzero(pos[j]++) = values[j][t];
+    }
+    for(size_t t=1; t < rows[j].size(); t++) {
+      l = rows[j][t];
+      rowind(pos[l]) = j;
+      nonzero(pos[l]++) = values[j][t];
+    }
+    std::vector<int>().swap(rows[j]);
+    std::vector<double>().swap(values[j]);
+  }
+  return arma::sp_mat(rowind, colptr, nonzero, p, p);
+}
+
+/**
+   elnet on a banded LD matrix
+
+   The coordinate descent of elnetCore, over all the SNPs of R, in windows
+   of window consecutive SNPs: each window is swept until its betas change
+   by less than thr, the others being held fixed, and the windows are then
+   slid by half their width for the next pass, so that the SNPs at the edge
+   of a window are solved with those on either side of them. The passes
+   stop once no beta of a pass changes by thr or more in the first sweep of
+   its window.
+
+   @R the banded LD matrix (see bandedLD)
+   @scale the factor of R in t(X)*X, i.e. 1 - shrink
+   @x the betas, updated in place
+   @Rx receives (R (x) I_q) x
+   @d receives R(j,j), and b the terms of the updates which do not depend
+   on the betas (t2): with Rx, sized on the first call and then reused
+   @window the number of SNPs of a window
+   @stats receives the statistics of the call: sweeps counts the updates,
+   in sweeps over all the SNPs
+   @abort when not NULL, bandCore stops early once it is set, and does not
+   call R
+   @return conv
+
+ */
+template <class Model>
+int bandCore(const Model& model, double lambda1, double lambda2, const arma::sp_mat& R,
+             double scale, const arma::vec& r, double thr, arma::vec& x, arma::vec& Rx,
+             arma::vec& d, arma::vec& b, int window, int trace, int maxiter, ElnetStats& stats,
+             const std::atomic<bool>* abort) {
+  int q = model.q();
+  int p = R.n_cols;
+  int j, k, m;
+  const arma::uword* rowind = R.row_indices;
+  const arma::uword* colptr = R.col_ptrs;
+  const double* values = R.values;
+
+  // R(j,j), and the terms which do not depend on the betas (t2)
+  d.zeros(p);
+  b.set_size(p*q);
+  Rx.zeros(p*q);
+  for(j=0; j < p; j++) {
+    for(arma::uword t=colptr[j]; t < colptr[j+1]; t++) {
+      if(rowind[t] == (arma::uword) j) d(j) = values[t];
+      for(k=0; k < q; k++) Rx(q*rowind[t]+k) += values[t] * x(q*j+k);
+    }
+    for(k=0; k < q; k++) b(q*j+k) = model.t2(q, k, r.memptr() + q*j);
+  }
+
+  // One sweep over the SNPs from a to e - 1
+  auto sweep = [&](int a, int e) {
+    double dlx = 0.0;
+    for(j=a; j < e; j++) {
+      double denom = scale * d(j) + lambda2;
+      for(k=0; k < q; k++) {
+        int c = q*j+k;
+        double S = scale * (Rx(c) - d(j) * x(c));
+        double A = model.t1(q, k, x.memptr() + q*j, denom) + b(c) + model.t3(k, S);
+        double v = 0.0;
+        if (A + lambda1 < 0) v = (A + lambda1)/model.denominator(k, denom);
+        if (A - lambda1 > 0) v = (A - lambda1)/model.denominator(k, denom);
+        double del = v - x(c);
+        if (del == 0.0) continue;
+        x(c) = v;
+        dlx = std::max(dlx, std::abs(del));
+        for(arma::uword t=colptr[j]; t < colptr[j+1]; t++) Rx(q*rowind[t]+k) += values[t] * del;
+      }
+    }
+    return dlx;
+  };
+
+  int width = std::max(1, std::min(window, p));
+  double updates = 0.0;
+  int conv = 0;
+  for(m=0; m < maxiter; m++) {
+    double passdlx = 0.0;
+    int offset = (m % 2 == 1) ? width / 2 : 0;
+    for(int w0 = (offset > 0) ? offset - width : 0; w0 < p; w0 += width) {
+      int a = std::max(w0, 0), e = std::min(w0 + width, p);
+      for(int s=0; s < maxiter; s++) {
+        double dlx = sweep(a, e);
+        updates += e - a;
+        if(s == 0) passdlx = std::max(passdlx, dlx);
+        if(dlx < thr) break;
+      }
+    }
+    if(trace > 0 && abort == NULL) Rcpp::Rcout << "Pass: " << m << "\n";
+    if(passdlx < thr) {
+      conv = 1;
+      break;
+    }
+    if(abort == NULL) {
+      Rcpp::checkUserInterrupt();
+    } else if(abort->load()) break;
+  }
+  stats.sweeps = (int) std::ceil(updates / p);
+  return conv;
+}
+
+#endif
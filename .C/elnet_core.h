@@ -0,0 +1,445 @@
+/**
+   lassosum
+   elnet_core.h
+   Purpose: the coordinate descent of elnet and repelnet, shared by the
+   linear and the mixed model
+
+   The two models only differ in how the update of beta x(q*j+k) is formed
+   from its three terms: t1 couples it to the other traits of SNP j, t2 is
+   the linear term and t3 the cross product with the other SNPs,
+   S = t(X[,q*j+k])*yhat without the contribution of SNP j. The model is a
+   policy class, resolved at compile time, which provides
+
+     int q() const                          number of traits
+     double t1(q, k, xj, denom) const       t1, xj the q betas of SNP j and
+                                            denom = diag(q*j+k) + lambda2
+     double t2(q, k, rj) const              t2, rj the q correlations of SNP j
+     double t3(k, S) const                  t3
+     double denominator(k, denom) const     the denominator of the update
+     double objective(lambda1, lambda2, diag, r, x, yhat) const
+                                            the objective of which the updates
+                                            are a coordinate descent (see the
+                                            Anderson acceleration)
+     bool gap(q, lambda2, D, P) const       fills D and P (see elnet_gap.h),
+                                            or returns false if the model has
+                                            no duality gap
+
+   so that every fast path of the engine applies to both models.
+
+ */
+#ifndef LASSOSUM_ELNET_CORE_H
+#define LASSOSUM_ELNET_CORE_H
+
+#include <vector>
+#include <atomic>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <RcppArmadillo.h>
+#include "block_scheduler.h"
+#include "elnet_workspace.h"
+#include "elnet_gap.h"
+
+/**
+   The body of elnet
+
+   It does not call R when abort is given, so that it can run on the worker
+   threads of repelnet: it then stops early once abort is set instead of
+   checking for interrupts, and prints nothing. Q is the number of traits
+   when known at compile time, so that the loops over the traits of a SNP
+   have constant bounds and are unrolled, or 0 to take it from the model
+   (see elnetCoreFor).
+
+   @model the model (see above)
+   @lambda1 lambda
+   @lambda2 lambda
+   @diag diag(X'X)
+   @X genotype matrix of the block
+   @r correlations
+   @thr threshold
+   @x beta coef, updated in place
+   @yhat X*x, updated in place
+   @trace if > 0 displays the current iteration
+   @maxiter maximal number of iterations
+   @ctrl the options of elnet
+   @ws the workspace
+   @stats receives the statistics of the call
+   @abort see above
+   @return conv
+
+ */
+template <class Model, int Q>
+int elnetCore(const Model& model, double lambda1, double lambda2, const arma::vec& diag,
+              const arma::mat& X, const arma::vec& r, double thr, arma::vec& x,
+              arma::vec& yhat, int trace, int maxiter, const ElnetControl& ctrl,
+              ElnetWorkspace& ws, ElnetStats& stats, const std::atomic<bool>* abort)
+{
+
+
+  // diag is basically diag(X'X)
+  // Also, ensure that the yhat=X*x in the input. Usually, both x and yhat are preset to 0.
+  // They are modified in place in this function.
+  // The q columns of a SNP are orthogonal (see GenotypeMatrixMultiplePhenotypes), so that
+  // the contribution of SNP j to t(X[,q*j+k])*yhat is diag(q*j+k)*x(q*j+k).
+
+
+  int nq =X.n_rows;
+  int pq =X.n_cols;
+  const int q = (Q > 0) ? Q : model.q();
+  int p = (pq)/(q);
+
+
+  double dlx,del,t1,t2,t3, A,S,denom ;
+
+  // j : indice des SNPs, k : indice des traits, m: indice des itérations,
+  // jj position de j dans l'ordre de la sweep
+  int j,k,m,jj;
+
+  // On définit le vecteur x_before ( qui contient les valeurs des betas à l'itération t-1 )
+  // et yhat_before ( = X*x_before ), tous deux pris dans le workspace
+  arma::vec x_before = workspaceView(ws.x_before, pq);
+  arma::vec yhat_before = workspaceView(ws.yhat_before, nq);
+
+  // Avec JACOBI, t1 et t3 sont calculés à partir de x_before et yhat_before ; sinon
+  // (Gauss-Seidel) à partir de x et yhat, qui contiennent déjà les mises à jour de la sweep
+  bool jacobi = (ctrl.scheme == JACOBI);
+  const arma::vec& xsrc = jacobi ? x_before : x;
+  const arma::vec& yhatsrc = jacobi ? yhat_before : yhat;
+  std::mt19937 rng(pq);
+
+  // Le terme t2 ne dépend pas des betas : on le calcule une fois pour toutes dans ws.b,
+  // au lieu de le recalculer à chaque sweep
+  for(j=0; j < p; j++) {
+    for(k=0; k < q; k++) ws.b.at(q*j+k) = model.t2(q, k, r.memptr() + q*j);
+  }
+
+  // Saut de dualité (voir elnet_gap.h), quand le modèle en a un
+  std::fill(ws.active.begin(), ws.active.begin() + pq, 1);
+  bool gap = false;
+  if(ctrl.gaptol > 0 && model.gap(q, lambda2, ws.gapD, ws.gapP)) gap = gapSetup(ws, p, q);
+
+  // Mise à jour jointe (ctrl.joint) : les lignes non nulles de la colonne q*j+k de X sont
+  // les lignes q*i+k du trait k, de sorte qu'une seule passe sur les n lignes de chaque
+  // trait donne les S des q traits du SNP
+  int n = nq/q;
+  ws.jointS.set_size(q);
+
+  int conv=0;
+
+  for(m=0;m<maxiter ;m++) {
+    dlx=0.0;
+    // Mon beta est x : c'est un vecteur de taille pq : x = ( q betas pour le SNP1 , q betas pour le SNP 2, .., q betas pour le SNP p )
+
+    x_before = x;
+    if(jacobi) yhat_before = yhat;
+    sweepOrder(ctrl.scheme, p, ws, rng, m == 0);
+
+    // boucle sur les SNPS :
+    for (jj= 0; jj<p; jj++) {
+      j = ws.order[jj];
+      ws.priority.at(j) = 0.0;
+
+      if(ctrl.joint) {
+        // Les q betas du SNP j minimisent un problème en dimension q, couplé par t1, dont
+        // le terme linéaire est t2+t3 : t3 ne dépend que des autres SNPs, on le calcule
+        // une fois pour les q traits, puis on résout ce problème par descente de
+        // coordonnées interne
+        for(k=0; k < q; k++) {
+          ws.jointS.at(k) = -diag.at(q*j+k)*x_before.at(q*j+k);
+        }
+        const double* yp = yhatsrc.memptr();
+        for(int i=0; i < n; i++) {
+          for(k=0; k < q; k++) ws.jointS.at(k) += X.at(q*i+k, q*j+k)*yp[q*i+k];
+        }
+
+        for(int inner=0; inner < 100; inner++) {
+          double dinner=0.0;
+          for(k=0; k < q; k++) {
+            if(!ws.active[q*j+k]) continue;
+            denom = diag.at(q*j+k) + lambda2;
+            A = model.t1(q, k, x.memptr() + q*j, denom) + ws.b.at(q*j+k) +
+              model.t3(k, ws.jointS.at(k));
+            double den = model.denominator(k, denom);
+            double xk = 0.0;
+            if (A + lambda1 < 0) xk = (A + lambda1)/den;
+            if (A - lambda1 > 0) xk = (A - lambda1)/den;
+            dinner = std::max(dinner, std::abs(xk - x.at(q*j+k)));
+            x.at(q*j+k) = xk;
+          }
+          if(dinner < 0.1*thr) break;
+        }
+
+        bool changed = false;
+        for(k=0; k < q; k++) {
+          del = x.at(q*j+k)-x_before.at(q*j+k);
+          ws.jointS.at(k) = del; // S n'est plus utile : on y garde les variations
+          if(del == 0.0) continue;
+          changed = true;
+          dlx=std::max(dlx,std::abs(del));
+          ws.priority.at(j)=std::max(ws.priority.at(j),std::abs(del));
+        }
+        if(changed) {
+          double* yh = yhat.memptr();
+          for(int i=0; i < n; i++) {
+            for(k=0; k < q; k++) yh[q*i+k] += ws.jointS.at(k)*X.at(q*i+k, q*j+k);
+          }
+        }
+        continue;
+      }
+
+      // Pour chaque SNP, on fait une boucle sur les traits :
+      for(k=0; k < q; k++) {
+
+        // les betas écartés par le saut de dualité restent nuls
+        if(!ws.active[q*j+k]) continue;
+
+        x.at(q*j+k)=0.0;
+
+
+        // On initialise les termes dont on aura besoin : t1, t2 et t3 ( ce sont les 3 composantes de A comme définie dans la partie théorique )
+        // ainsi que A et S
+
+        denom = diag.at(q*j+k) + lambda2 ;
+
+        // RMQ : c++ commence à indicer à partir de 0 ( le premier élément d'un vecteur à l'indice 0),
+        // alors que R commence à indicer à partir de 1 ( le premier élément d'un vecteur à l'indice 1 )
+
+        // On définit le terme t1 :
+
+        t1 = model.t1(q, k, xsrc.memptr() + q*j, denom);
+
+        // On définit le terme t2 ( calculé avant les sweeps ) :
+
+        t2 = ws.b.at(q*j+k);
+
+        // On définit le terme t3 : S est la somme sur l != j de t(Xj)*Xl*Betal, soit
+        // t(X[,q*j+k])*yhat sans la contribution du SNP j ( yhat contient encore
+        // l'ancienne valeur x_before(q*j+k) )
+
+        S = colDot(X, q*j+k, yhatsrc) - diag.at(q*j+k)*x_before.at(q*j+k);
+
+        t3 = model.t3(k, S);
+
+        A=t1+t2+t3;
+
+        // On définit maintenant la solution Beta
+
+        if (A < 0){
+          if (A + lambda1 <0 ) {
+            x.at(q*j+k) = (A+ lambda1)/model.denominator(k, denom);
+          }
+        }
+
+        if (A > 0){
+          if (A - lambda1> 0){
+            x.at(q*j+k) = (A- lambda1)/model.denominator(k, denom);
+          }
+        }
+
+        if (x.at(q*j+k)==x_before.at(q*j+k) ) continue;
+        del = x.at(q*j+k)-x_before.at(q*j+k);
+        dlx=std::max(dlx,std::abs(del));
+        ws.priority.at(j)=std::max(ws.priority.at(j),std::abs(del));
+
+        yhat += del*X.col(q*j+k);
+      }
+    }
+
+    if(abort == NULL) {
+      Rcpp::checkUserInterrupt();
+      if(trace > 0) Rcpp::Rcout << "Iteration: " << m << "\n";
+    } else if(abort->load()) break;
+
+    if(gap) {
+      // On calcule le saut de dualité toutes les gapevery sweeps, ou quand les betas ne
+      // bougent presque plus, et on écarte les betas dont il prouve qu'ils sont nuls
+      if(dlx == 0.0) {
+        conv=1;
+        break;
+      }
+      if(m % ctrl.gapevery == 0 || dlx < thr) {
+        double primal, s;
+        stats.gap = dualityGap(lambda1, X, x, yhat, ws, q, primal, s);
+        if(stats.gap <= ctrl.gaptol*std::abs(primal)) {
+          conv=1;
+          break;
+        }
+        stats.screened = gapScreen(lambda1, stats.gap, s, diag, X, x, yhat, ws, q);
+      }
+    } else if(dlx < thr) {
+      conv=1;
+      break;
+    }
+
+    // Accélération d'Anderson : toutes les anderson+1 sweeps, on extrapole à partir
+    // des betas des dernières sweeps, et on ne garde le point extrapolé que s'il
+    // diminue l'objectif ; sinon on continue à partir de x
+    if(ctrl.anderson > 0) {
+      int K = ctrl.anderson;
+      std::copy(x.memptr(), x.memptr() + pq, ws.xhist.colptr(m % (K+1)));
+      if(m % (K+1) == K && andersonWeights(ws, K, pq)) {
+        arma::vec xacc = workspaceView(ws.xacc, pq);
+        arma::vec yacc = workspaceView(ws.yacc, nq);
+        andersonPoint(ws, K, pq, xacc);
+        yacc = X * xacc;
+        if(model.objective(lambda1, lambda2, diag, r, xacc, yacc) <
+           model.objective(lambda1, lambda2, diag, r, x, yhat)) {
+          x = xacc;
+          yhat = yacc;
+          stats.extrapolations++;
+        }
+      }
+    }
+  }
+  stats.sweeps = std::min(m + 1, maxiter);
+
+  return conv;
+}
+
+// elnetCore for a given model and number of traits
+template <class Model>
+using ElnetCoreFn = int (*)(const Model&, double, double, const arma::vec&, const arma::mat&,
+                            const arma::vec&, double, arma::vec&, arma::vec&, int, int,
+                            const ElnetControl&, ElnetWorkspace&, ElnetStats&,
+                            const std::atomic<bool>*);
+
+/**
+   elnetCore for q traits: specialised for q <= 8, generic above
+
+ */
+template <class Model>
+ElnetCoreFn<Model> elnetCoreFor(int q) {
+  switch(q) {
+  case 1: return elnetCore<Model, 1>;
+  case 2: return elnetCore<Model, 2>;
+  case 3: return elnetCore<Model, 3>;
+  case 4: return elnetCore<Model, 4>;
+  case 5: return elnetCore<Model, 5>;
+  case 6: return elnetCore<Model, 6>;
+  case 7: return elnetCore<Model, 7>;
+  case 8: return elnetCore<Model, 8>;
+  default: return elnetCore<Model, 0>;
+  }
+}
+
+/**
+   Solves the q betas of a SNP of zero variance
+
+   Its columns of X are zero, so that diag and t3 are zero and its betas
+   depend on nothing but r and, through t1, on each other: they solve a
+   problem of dimension q of their own, which does not involve X. The
+   first pass is exact when t1 is zero (one trait); otherwise the passes go
+   on until the betas change by less than thr. The updates of a model which
+   is not convex (see LinearModel) may have no fixed point: the betas are
+   then left as they were.
+
+   @r the q correlations of the SNP
+   @x its q betas, updated in place
+   @xk q doubles of scratch space, so that the path allocates nothing
+   @return 1 if the betas converged, 0 otherwise
+
+ */
+template <class Model>
+int constantSnpCore(const Model& model, double lambda1, double lambda2, const double* r,
+                    double* x, double* xk, double thr, int maxiter)
+{
+  int q = model.q();
+  std::copy(x, x + q, xk);
+  for(int m=0; m < maxiter; m++) {
+    double dlx = 0.0;
+    for(int k=0; k < q; k++) {
+      double A = model.t1(q, k, xk, lambda2) + model.t2(q, k, r) + model.t3(k, 0.0);
+      double v = 0.0;
+      if (A + lambda1 < 0) v = (A + lambda1)/model.denominator(k, lambda2);
+      if (A - lambda1 > 0) v = (A - lambda1)/model.denominator(k, lambda2);
+      dlx = std::max(dlx, std::abs(v - xk[k]));
+      xk[k] = v;
+    }
+    if(!std::isfinite(dlx)) break;
+    if(dlx < thr) {
+      for(int k=0; k < q; k++) x[k] = xk[k];
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+   The body of repelnet
+
+   Solves every block with core and the workspaces ws (one per thread, see
+   elnetWorkspaces), then adds the fitted values of every block to yhat.
+
+   @presolved the blocks which already have their solution in x (e.g. by
+   FISTA): only their fitted values are added to yhat
+   @stats receives the statistics of each block
+   @abort when not NULL, repelnetCore runs on a worker thread: the blocks
+   are solved one after the other (nthreads must be 1) without calling R,
+   stopping early once abort is set
+   @return the smallest conv of the blocks
+
+ */
+template <class Model>
+int repelnetCore(const Model& model, double lambda1, double lambda2, arma::vec& diag,
+                 arma::mat& X, arma::vec& r, double thr, arma::vec& x, arma::vec& yhat,
+                 int trace, int maxiter, arma::Col<int>& startvec, arma::Col<int>& endvec,
+                 int nthreads, ElnetCoreFn<Model> core, const ElnetControl& ctrl,
+                 std::vector<ElnetWorkspace>& ws, std::vector<ElnetStats>& stats,
+                 const std::vector<char>& presolved, const std::atomic<bool>* abort = NULL)
+{
+
+  // Repeatedly call elnet by blocks...
+  int nreps=startvec.n_elem;
+  std::atomic<int> out(1);
+
+  // The block is passed to elnet as views sharing the memory of X, diag, r
+  // and x (copy_aux_mem = false, strict = true): X.cols() and subvec()
+  // would be copied in full to bind to elnet's const references, and x is
+  // updated in place. Its yhat is taken from the workspace.
+  auto solve = [&](int i, int thread, const std::atomic<bool>* abort) {
+    if(presolved[i]) return;
+    int len=endvec(i)-startvec(i)+1;
+    arma::mat Xtouse(X.colptr(startvec(i)), X.n_rows, len, false, true);
+    arma::vec diagtouse(diag.memptr()+startvec(i), len, false, true);
+    arma::vec rtouse(r.memptr()+startvec(i), len, false, true);
+    arma::vec xtouse(x.memptr()+startvec(i), len, false, true);
+    arma::vec yhattouse=workspaceView(ws[thread].yhat, X.n_rows);
+    yhattouse=Xtouse * xtouse;
+
+    int conv=core(model, lambda1, lambda2, diagtouse, Xtouse, rtouse,
+                  thr, xtouse,
+                  yhattouse, trace - 1, maxiter, ctrl, ws[thread], stats[i], abort);
+    // out = min(out, conv), sans tableau par bloc
+    int o=out.load();
+    while(conv < o && !out.compare_exchange_weak(o, conv)) {}
+  };
+
+  if(nthreads > 1 && nreps > 1) {
+    // The blocks are independent: solve them on nthreads threads, each block
+    // writing its own part of x
+    runBlocks(nreps, blocksLargestFirst(startvec, endvec), nthreads, trace,
+              [&](int i, int thread, const std::atomic<bool>& abort) {
+      solve(i, thread, &abort);
+    });
+  } else {
+    for(int i=0;i < nreps; i++) {
+      solve(i, 0, abort);
+      if(trace > 0 && abort == NULL) Rcpp::Rcout << "Block: " << i << "\n";
+    }
+  }
+
+  // The fitted values of each block are added in block order, so that the
+  // result does not depend on the number of threads. Those of a block go
+  // through the yhat of the first workspace rather than a temporary.
+  arma::vec yhatblock=workspaceView(ws[0].yhat, X.n_rows);
+  for(int i=0;i < nreps; i++) {
+    if(endvec(i) < startvec(i)) continue;
+    arma::mat Xtouse(X.colptr(startvec(i)), X.n_rows, endvec(i)-startvec(i)+1, false, true);
+    arma::vec xtouse(x.memptr()+startvec(i), endvec(i)-startvec(i)+1, false, true);
+    yhatblock = Xtouse * xtouse;
+    yhat += yhatblock;
+  }
+  return out.load();
+}
+
+#endif
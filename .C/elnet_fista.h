@@ -0,0 +1,242 @@
+/**
+   lassosum
+   elnet_fista.h
+   Purpose: solve a block of elnet for every lambda at once by accelerated
+   proximal gradient (FISTA) on the block's LD matrix
+
+   With the betas of a block as a p x q matrix B (row j for SNP j, column k
+   for trait k), the objective of elnet (see elnet_gap.h) is
+
+     0.5*tr(B'RBD) + 0.5*tr(BPB') - tr(B'b) + lambda1*sum(abs(B))
+
+   where R = G'G is the LD matrix of the block, G the standardized genotypes
+   of its SNPs, D the diagonal q x q matrix gapD and P the q x q matrix gapP.
+   Its gradient RBD + BP - b costs one product with R, and the betas of all
+   the lambdas are stacked side by side, so that an iteration for every
+   trait and every lambda is a single matrix-matrix product. Coordinate
+   descent, in comparison, goes through the block one SNP at a time, once
+   per lambda, which does not scale to large blocks.
+
+   The step is 1/L, with L an estimate of the largest eigenvalue of H that
+   is doubled whenever it proves too small (backtracking). The iterations
+   of a lambda stop once its duality gap is small enough.
+
+ */
+#ifndef LASSOSUM_ELNET_FISTA_H
+#define LASSOSUM_ELNET_FISTA_H
+
+#include <vector>
+#include <atomic>
+#include <cmath>
+#include <algorithm>
+#include <RcppArmadillo.h>
+#include "elnet_workspace.h"
+#include "elnet_gap.h"
+
+// The scratch space of fistaBlock, sized for the largest block and every
+// lambda, so that the blocks are solved without heap allocation. It also
+// holds the LD matrix, the linear term and the betas of the block being
+// solved, fistaBlock taking views of these. Every thread needs its own.
+struct FistaWorkspace {
+  ElnetWorkspace gap;  // the constants of the duality gap (see gapSetup)
+  arma::vec v, w;      // the power iteration
+  arma::mat R, b, B;   // the block, as passed to fistaBlock
+  arma::mat X, Xold, RX, RXold, Yp, RY, Xn, RXn;
+  std::vector<double> t, tn;
+  std::vector<char> done;
+
+  FistaWorkspace(int p, int q, int nl) :
+    gap(p*q, 0), v(p), w(p), R(p, p), b(p, q), B(p, q*nl), X(p, q*nl), Xold(p, q*nl),
+    RX(p, q*nl), RXold(p, q*nl), Yp(p, q*nl), RY(p, q*nl), Xn(p, q*nl), RXn(p, q*nl),
+    t(nl), tn(nl), done(nl) {}
+};
+
+/**
+   Solves a block for every lambda by FISTA
+
+   @R the LD matrix of the block (p x p)
+   @b the linear term of the objective (p x q)
+   @D the scale of each trait (see elnet_gap.h)
+   @P the q x q matrix coupling the traits of a SNP (see elnet_gap.h)
+   @lambda the lambdas
+   @tol a lambda is solved once its duality gap is below tol times its
+   objective
+   @maxiter maximal number of iterations
+   @B the initial betas of every lambda, side by side (p x q*nlambda),
+   replaced by the solutions
+   @stats the statistics of each lambda: sweeps counts the iterations
+   @conv 1 for each lambda solved, 0 otherwise
+   @abort when not NULL, FISTA stops early once it is set, and does not call R
+   @fw the scratch space, sized for at least p SNPs, q traits and every lambda
+   @return false if the objective is not convex, B being then untouched
+
+ */
+inline bool fistaBlock(const arma::mat& R, const arma::mat& b, const arma::vec& D,
+                       const arma::mat& P, const arma::vec& lambda, double tol,
+                       int maxiter, arma::mat& B, std::vector<ElnetStats>& stats,
+                       std::vector<int>& conv, const std::atomic<bool>* abort,
+                       FistaWorkspace& fw) {
+  int p = R.n_rows, q = D.n_elem, nl = lambda.n_elem, nc = q*nl;
+  int i, j, k, h, l;
+
+  // The constants of the duality gap, which also check that the objective is convex
+  ElnetWorkspace& gws = fw.gap;
+  gws.gapD = D;
+  gws.gapP = P;
+  for(j=0; j < p; j++)
+    for(k=0; k < q; k++) gws.b.at(q*j+k) = b.at(j,k);
+  if(!gapSetup(gws, p, q)) return false;
+  double Y = gws.gapY;
+
+  // Largest eigenvalue of R by power iteration, then L <= max(D)*rho(R) + max row sum of |P|
+  arma::vec v(fw.v.memptr(), p, false, true), w(fw.w.memptr(), p, false, true);
+  v.fill(1.0 / std::sqrt((double) p));
+  double rho = 0.0;
+  for(i=0; i < 50; i++) {
+    w = R * v;
+    double nw = 0.0;
+    for(j=0; j < p; j++) nw += w.at(j) * w.at(j);
+    nw = std::sqrt(nw);
+    if(nw == 0.0) break;
+    rho = nw;
+    for(j=0; j < p; j++) v.at(j) = w.at(j) / nw;
+  }
+  double Dmax = 0.0, Pmax = 0.0;
+  for(k=0; k < q; k++) {
+    double s = 0.0;
+    for(h=0; h < q; h++) s += std::abs(P.at(k,h));
+    Pmax = std::max(Pmax, s);
+    Dmax = std::max(Dmax, D.at(k));
+  }
+  double L = 1.05 * Dmax * rho + Pmax;
+
+  // Les matrices p x nc sont des vues de l'espace de travail
+  arma::mat X(fw.X.memptr(), p, nc, false, true), Xold(fw.Xold.memptr(), p, nc, false, true);
+  arma::mat RX(fw.RX.memptr(), p, nc, false, true), RXold(fw.RXold.memptr(), p, nc, false, true);
+  arma::mat Yp(fw.Yp.memptr(), p, nc, false, true), RY(fw.RY.memptr(), p, nc, false, true);
+  arma::mat Xn(fw.Xn.memptr(), p, nc, false, true), RXn(fw.RXn.memptr(), p, nc, false, true);
+  X = B;
+  Xold = B;
+  RX = R * B;
+  RXold = RX;
+  std::vector<double>& t = fw.t;
+  std::vector<double>& tn = fw.tn;
+  std::vector<char>& done = fw.done;
+  t.assign(nl, 1.0);
+  tn.assign(nl, 1.0);
+  done.assign(nl, 0);
+  int ndone = 0;
+  conv.assign(nl, 0);
+  for(l=0; l < nl; l++) stats[l] = ElnetStats();
+
+  int it;
+  for(it=0; it < maxiter && ndone < nl; it++) {
+
+    // The extrapolated point Y = X + beta*(X - Xold), and RY, without a product
+    for(l=0; l < nl; l++) {
+      if(done[l]) continue;
+      tn[l] = 0.5 * (1.0 + std::sqrt(1.0 + 4.0 * t[l] * t[l]));
+      double beta = (t[l] - 1.0) / tn[l];
+      for(int c=l*q; c < (l+1)*q; c++) {
+        for(j=0; j < p; j++) {
+          Yp.at(j,c) = X.at(j,c) + beta * (X.at(j,c) - Xold.at(j,c));
+          RY.at(j,c) = RX.at(j,c) + beta * (RX.at(j,c) - RXold.at(j,c));
+        }
+      }
+    }
+
+    // Proximal gradient step from Y, with backtracking on L
+    for(;;) {
+      for(l=0; l < nl; l++) {
+        for(k=0; k < q; k++) {
+          int c = l*q+k;
+          if(done[l]) {
+            for(j=0; j < p; j++) Xn.at(j,c) = X.at(j,c);
+            continue;
+          }
+          for(j=0; j < p; j++) {
+            double g = RY.at(j,c) * D.at(k) - b.at(j,k);
+            for(h=0; h < q; h++) g += Yp.at(j,l*q+h) * P.at(h,k);
+            double z = Yp.at(j,c) - g / L;
+            double thr = lambda.at(l) / L;
+            Xn.at(j,c) = (z > thr) ? z - thr : ((z < -thr) ? z + thr : 0.0);
+          }
+        }
+      }
+      RXn = R * Xn;
+
+      // f(Xn) <= f(Y) + <grad f(Y), Xn - Y> + L/2*|Xn - Y|^2, i.e. d'Hd <= L*|d|^2
+      bool ok = true;
+      for(l=0; l < nl && ok; l++) {
+        if(done[l]) continue;
+        double dHd = 0.0, dd = 0.0;
+        for(k=0; k < q; k++) {
+          int c = l*q+k;
+          for(j=0; j < p; j++) {
+            double d = Xn.at(j,c) - Yp.at(j,c);
+            double Pd = 0.0;
+            for(h=0; h < q; h++) Pd += P.at(k,h) * (Xn.at(j,l*q+h) - Yp.at(j,l*q+h));
+            dHd += d * (D.at(k) * (RXn.at(j,c) - RY.at(j,c)) + Pd);
+            dd += d * d;
+          }
+        }
+        if(dHd > L * dd * (1.0 + 1e-10)) ok = false;
+      }
+      if(ok) break;
+      L *= 2.0;
+    }
+
+    // Restart the momentum of a lambda when it points uphill
+    for(l=0; l < nl; l++) {
+      if(done[l]) continue;
+      double s = 0.0;
+      for(int c=l*q; c < (l+1)*q; c++)
+        for(j=0; j < p; j++) s += (Yp.at(j,c) - Xn.at(j,c)) * (Xn.at(j,c) - X.at(j,c));
+      t[l] = (s > 0.0) ? 1.0 : tn[l];
+    }
+    Xold = X;
+    RXold = RX;
+    X = Xn;
+    RX = RXn;
+
+    // Duality gap of each lambda (see dualityGap), every 10 iterations
+    if(it % 10 == 9 || it == maxiter - 1) {
+      for(l=0; l < nl; l++) {
+        if(done[l]) continue;
+        double Q = 0.0, bx = 0.0, l1 = 0.0, ginf = 0.0;
+        for(k=0; k < q; k++) {
+          int c = l*q+k;
+          for(j=0; j < p; j++) {
+            double Hx = RX.at(j,c) * D.at(k);
+            for(h=0; h < q; h++) Hx += X.at(j,l*q+h) * P.at(h,k);
+            Q += X.at(j,c) * Hx;
+            bx += b.at(j,k) * X.at(j,c);
+            l1 += std::abs(X.at(j,c));
+            ginf = std::max(ginf, std::abs(b.at(j,k) - Hx));
+          }
+        }
+        double s = (ginf > lambda.at(l)) ? lambda.at(l) / ginf : 1.0;
+        double Rr = Y - 2.0 * bx + Q;
+        double primal = 0.5 * Q - bx + lambda.at(l) * l1;
+        stats[l].gap = 0.5 * (1.0 + s * s) * Rr - s * Y + s * bx + lambda.at(l) * l1;
+        stats[l].sweeps = it + 1;
+        if(stats[l].gap <= tol * std::abs(primal)) {
+          done[l] = 1;
+          conv[l] = 1;
+          ndone++;
+        }
+      }
+    }
+
+    if(abort == NULL) {
+      Rcpp::checkUserInterrupt();
+    } else if(abort->load()) break;
+  }
+  for(l=0; l < nl; l++)
+    if(!done[l]) stats[l].sweeps = it;
+
+  B = X;
+  return true;
+}
+
+#endif
@@ -0,0 +1,110 @@
+/**
+   lassosum
+   elnet_float.h
+   Purpose: elnet on genotypes stored in single precision
+
+   The standardized genotypes need far fewer than the 53 bits of a double,
+   and a coordinate descent is bound by the memory bandwidth of its passes
+   over the genotypes: stored as floats, they take half the memory and the
+   bandwidth, and twice as many fit in a SIMD register.
+
+   floatCore is the coordinate descent of elnetCore on a block of G, the
+   genotypes for one phenotype, rather than on the expanded genotypes X:
+   column q*j+k of X is column j of G on the rows of trait k, so that the
+   fitted values of trait k are G times the betas of trait k, kept as the
+   column k of an n x q matrix. The betas and the updates themselves stay
+   in double precision; the fitted values and the cross products are
+   accumulated in Acc, float for the solver, double for a final polishing
+   from its solution, on the same genotypes.
+
+ */
+#ifndef LASSOSUM_ELNET_FLOAT_H
+#define LASSOSUM_ELNET_FLOAT_H
+
+#include <vector>
+#include <atomic>
+#include <cmath>
+#include <algorithm>
+#include <RcppArmadillo.h>
+#include "elnet_workspace.h"
+
+/**
+   elnet on a block of single-precision genotypes
+
+   @G the standardized genotypes for one phenotype, in single precision
+   @j0 the first SNP of the block, a column of G
+   @p the number of SNPs of the block
+   @d the squared norm of each column of G
+   @scale the factor of G'G in t(X)*X, i.e. 1 - shrink
+   @r the correlations of the block
+   @x the betas of the block, updated in place
+   @yhat receives the fitted values of the block before scaling, G times
+   the betas of each trait, as an n x q matrix
+   @stats the sweeps of the call are added to stats.sweeps
+   @abort when not NULL, floatCore stops early once it is set, and does not
+   call R
+   @return conv
+
+ */
+template <class Acc, class Model>
+int floatCore(const Model& model, double lambda1, double lambda2, const arma::fmat& G, int j0,
+              int p, const arma::vec& d, double scale, const double* r, double thr, double* x,
+              Acc* yhat, int trace, int maxiter, ElnetStats& stats,
+              const std::atomic<bool>* abort) {
+  int q = model.q();
+  int n = G.n_rows;
+  int i, j, k, m;
+
+  // yhat = G x, trait par trait
+  std::fill(yhat, yhat + (size_t) n*q, Acc(0));
+  for(j=0; j < p; j++) {
+    const float* g = G.colptr(j0 + j);
+    for(k=0; k < q; k++) {
+      Acc a = (Acc) x[q*j+k];
+      if(a == 0) continue;
+      Acc* y = yhat + (size_t) n*k;
+      for(i=0; i < n; i++) y[i] += a * g[i];
+    }
+  }
+
+  int conv = 0;
+  for(m=0; m < maxiter; m++) {
+    double dlx = 0.0;
+    for(j=0; j < p; j++) {
+      const float* g = G.colptr(j0 + j);
+      double dj = d(j0 + j);
+      double denom = scale * dj + lambda2;
+      for(k=0; k < q; k++) {
+        int c = q*j+k;
+        Acc* y = yhat + (size_t) n*k;
+        Acc s = 0;
+        for(i=0; i < n; i++) s += g[i] * y[i];
+        double S = scale * ((double) s - dj * x[c]);
+        double A = model.t1(q, k, x + q*j, denom) + model.t2(q, k, r + q*j) + model.t3(k, S);
+        double v = 0.0;
+        if (A + lambda1 < 0) v = (A + lambda1)/model.denominator(k, denom);
+        if (A - lambda1 > 0) v = (A - lambda1)/model.denominator(k, denom);
+        double del = v - x[c];
+        if (del == 0.0) continue;
+        x[c] = v;
+        dlx = std::max(dlx, std::abs(del));
+        Acc a = (Acc) del;
+        for(i=0; i < n; i++) y[i] += a * g[i];
+      }
+    }
+
+    if(abort == NULL) {
+      Rcpp::checkUserInterrupt();
+      if(trace > 0) Rcpp::Rcout << "Iteration: " << m << "\n";
+    } else if(abort->load()) break;
+
+    if(dlx < thr) {
+      conv = 1;
+      break;
+    }
+  }
+  stats.sweeps += std::min(m + 1, maxiter);
+  return conv;
+}
+
+#endif
@@ -0,0 +1,168 @@
+/**
+   lassosum
+   elnet_gap.h
+   Purpose: duality gap and safe screening for elnet
+
+   elnet minimises 0.5*x'Hx - x'b + lambda1*sum(abs(x)) by coordinate
+   descent. When H splits as H = L'L + I_p (x) P, where L is X with the rows
+   of trait k scaled by sqrt(D(k)) and P is a positive definite q x q matrix
+   coupling the traits of a SNP, this is the lasso
+
+     0.5*|y - [L; I_p (x) C']x|^2 + lambda1*sum(abs(x)) - 0.5*|y|^2
+
+   with P = CC' and y = (0, (I_p (x) C^-1)b). Its duality gap bounds how far
+   the objective is from its minimum, whatever the scale of the problem, and
+   the gap-safe rules prove that some betas are zero at the solution, so
+   that they can be left out of the following sweeps. Both only need
+   X'yhat, i.e. one product with X.
+
+   The model fills ws.gapD, ws.gapP and ws.b before calling gapSetup.
+
+ */
+#ifndef LASSOSUM_ELNET_GAP_H
+#define LASSOSUM_ELNET_GAP_H
+
+#include <cmath>
+#include <algorithm>
+#include <RcppArmadillo.h>
+#include "elnet_workspace.h"
+
+/**
+   Prepares the duality gap of a block
+
+   Factorises P and computes |y|^2 = b'(I_p (x) P^-1)b.
+
+   @ws the workspace, with gapD, gapP and b set by the model
+   @p number of SNPs in the block
+   @q number of traits
+   @return false if H does not split as above, i.e. the objective is not
+   convex in that form, in which case there is no gap
+
+ */
+inline bool gapSetup(ElnetWorkspace& ws, int p, int q) {
+  const arma::mat& P = ws.gapP;
+  arma::mat& C = ws.gapC;
+  int a, c, j;
+
+  for(a=0; a < q; a++)
+    if(!(ws.gapD.at(a) > 0.0)) return false;
+
+  // Cholesky factorisation P = CC', C lower triangular
+  C.set_size(q, q);
+  for(a=0; a < q; a++) {
+    for(int h=0; h <= a; h++) {
+      double s = P.at(a,h);
+      for(c=0; c < h; c++) s -= C.at(a,c) * C.at(h,c);
+      if(h == a) {
+        if(!(s > 0.0)) return false;
+        C.at(a,a) = std::sqrt(s);
+      } else {
+        C.at(a,h) = s / C.at(h,h);
+      }
+    }
+    for(int h=a+1; h < q; h++) C.at(a,h) = 0.0;
+  }
+
+  ws.gapz.set_size(q);
+  double Y = 0.0;
+  for(j=0; j < p; j++) {
+    for(a=0; a < q; a++) {
+      double s = ws.b.at(q*j+a);
+      for(c=0; c < a; c++) s -= C.at(a,c) * ws.gapz.at(c);
+      ws.gapz.at(a) = s / C.at(a,a);
+      Y += ws.gapz.at(a) * ws.gapz.at(a);
+    }
+  }
+  ws.gapY = Y;
+  return true;
+}
+
+/**
+   Computes the duality gap at x
+
+   The dual point is the residual of the lasso above, scaled by s <= 1 to be
+   feasible. Leaves b - Hx in ws.grad for gapScreen.
+
+   @lambda1 lambda
+   @X genotype matrix of the block
+   @x beta coef
+   @yhat X*x
+   @ws the workspace, prepared by gapSetup
+   @q number of traits
+   @primal receives the objective at x
+   @s receives the scale of the dual point
+   @return the duality gap
+
+ */
+inline double dualityGap(double lambda1, const arma::mat& X, const arma::vec& x,
+                         const arma::vec& yhat, ElnetWorkspace& ws, int q,
+                         double& primal, double& s) {
+  const arma::mat& P = ws.gapP;
+  int pq = X.n_cols;
+  arma::vec grad = workspaceView(ws.grad, pq);
+  grad = X.t() * yhat;
+
+  double Q = 0.0, bx = 0.0, l1 = 0.0, ginf = 0.0;
+  for(int c=0; c < pq; c++) {
+    int j = c / q, k = c % q;
+    double Px = 0.0;
+    for(int h=0; h < q; h++) Px += P.at(k,h) * x.at(q*j+h);
+    double Hx = ws.gapD.at(k) * grad.at(c) + Px;
+    Q += x.at(c) * Hx;
+    bx += ws.b.at(c) * x.at(c);
+    l1 += std::abs(x.at(c));
+    grad.at(c) = ws.b.at(c) - Hx;
+    ginf = std::max(ginf, std::abs(grad.at(c)));
+  }
+
+  s = (ginf > lambda1) ? lambda1 / ginf : 1.0;
+  double Y = ws.gapY;
+  double R = Y - 2.0 * bx + Q; // |y - [L; I_p (x) C']x|^2
+  primal = 0.5 * Q - bx + lambda1 * l1;
+  return 0.5 * (1.0 + s * s) * R - s * Y + s * bx + lambda1 * l1;
+}
+
+/**
+   Screens out the betas proven to be zero at the solution
+
+   Beta c is zero at the solution if s*|grad(c)| + sqrt(2*gap*H(c,c)) <
+   lambda1. Such betas are set to zero, yhat updated, and marked inactive
+   in ws.active, for the remaining sweeps of the block.
+
+   @lambda1 lambda
+   @gap the duality gap, from dualityGap
+   @s the scale of the dual point, from dualityGap
+   @diag diag(X'X)
+   @X genotype matrix of the block
+   @x beta coef
+   @yhat X*x
+   @ws the workspace
+   @q number of traits
+   @return the number of betas screened out so far
+
+ */
+inline int gapScreen(double lambda1, double gap, double s, const arma::vec& diag,
+                     const arma::mat& X, arma::vec& x, arma::vec& yhat,
+                     ElnetWorkspace& ws, int q) {
+  int pq = X.n_cols;
+  double radius = std::sqrt(2.0 * std::max(gap, 0.0));
+  int screened = 0;
+
+  for(int c=0; c < pq; c++) {
+    if(ws.active[c]) {
+      int k = c % q;
+      double Hcc = ws.gapD.at(k) * diag.at(c) + ws.gapP.at(k,k);
+      if(s * std::abs(ws.grad.at(c)) + radius * std::sqrt(Hcc) >= lambda1) continue;
+      ws.active[c] = 0;
+      if(x.at(c) != 0.0) {
+        const double* xc = X.colptr(c);
+        for(int i=0; i < X.n_rows; i++) yhat.at(i) -= x.at(c) * xc[i];
+        x.at(c) = 0.0;
+      }
+    }
+    if(!ws.active[c]) screened++;
+  }
+  return screened;
+}
+
+#endif
@@ -0,0 +1,201 @@
+/**
+   lassosum
+   elnet_ldcolumns.h
+   Purpose: elnet on the LD columns of the SNPs it updates, computed on demand
+
+   elnetCore keeps yhat = X*x and computes t(X[,c])*yhat for every beta of
+   every sweep: each update goes through the n*q rows of X, whether the SNP
+   is in the model or not. With the LD matrix R = G'G of the block, the
+   same cross products are (R x)_j, and keeping Rx up to date only takes
+   the column of R of the SNPs whose betas change. Along a lambda path most
+   betas stay at zero: only the columns of the SNPs which enter the model
+   are ever needed, rather than the whole R of the block, which costs
+   n*p^2.
+
+   The columns are computed when a SNP is first updated, and kept in a cache
+   of a given size, the least recently used column being dropped to make
+   room for a new one. The cache of a block lives as long as the problem:
+   R does not depend on lambda nor on shrink, so that the next lambdas and
+   shrinks find the columns of the SNPs already in the model.
+
+ */
+#ifndef LASSOSUM_ELNET_LDCOLUMNS_H
+#define LASSOSUM_ELNET_LDCOLUMNS_H
+
+#include <vector>
+#include <atomic>
+#include <cmath>
+#include <algorithm>
+#include <RcppArmadillo.h>
+#include "elnet_workspace.h"
+
+/**
+   The LD columns of the SNPs of a block, computed on demand
+
+ */
+class LdColumnCache {
+public:
+  double hits;    // columns found in the cache
+  double misses;  // columns computed
+
+  LdColumnCache() : hits(0.0), misses(0.0), G(NULL), j0(0), p(0), used(0), head(-1), tail(-1) {}
+
+  /**
+     @G the standardized genotypes for one phenotype, which must outlive the
+     cache
+     @j0 the first SNP of the block, a column of G
+     @p the number of SNPs of the block
+     @memory the size of the cache in bytes; it always holds one column at
+     least
+
+   */
+  LdColumnCache(const arma::mat& G, int j0, int p, double memory) :
+    hits(0.0), misses(0.0), G(&G), j0(j0), p(p), used(0), head(-1), tail(-1) {
+    int capacity = (int) std::min((double) p, std::floor(memory / (8.0 * std::max(p, 1))));
+    capacity = std::max(capacity, 1);
+    columns.set_size(p, capacity);
+    slot.assign(p, -1);
+    snp.assign(capacity, -1);
+    prev.assign(capacity, -1);
+    next.assign(capacity, -1);
+    d.set_size(p);
+    for(int j=0; j < p; j++) d(j) = arma::dot(G.col(j0 + j), G.col(j0 + j));
+  }
+
+  int size() const { return p; }
+
+  // R(j,j)
+  double diag(int j) const { return d(j); }
+
+  /**
+     Column j of R, valid until the next call
+
+   */
+  const double* column(int j) {
+    int s = slot[j];
+    if(s >= 0) {
+      hits++;
+      unlink(s);
+    } else {
+      misses++;
+      if(used < (int) snp.size()) {
+        s = used++;
+      } else {
+        // La colonne utilisée le moins récemment laisse sa place
+        s = tail;
+        unlink(s);
+        slot[snp[s]] = -1;
+      }
+      snp[s] = j;
+      slot[j] = s;
+      arma::vec gj(const_cast<double*>(G->colptr(j0 + j)), G->n_rows, false, true);
+      double* out = columns.colptr(s);
+      for(int l=0; l < p; l++) out[l] = colDot(*G, j0 + l, gj);
+    }
+    // En tête de la liste : la plus récemment utilisée
+    prev[s] = -1;
+    next[s] = head;
+    if(head >= 0) prev[head] = s;
+    head = s;
+    if(tail < 0) tail = s;
+    return columns.colptr(s);
+  }
+
+private:
+  const arma::mat* G;
+  int j0, p;
+  arma::mat columns;        // the columns in the cache
+  arma::vec d;
+  std::vector<int> slot;    // the column of columns of each SNP, -1 if none
+  std::vector<int> snp;     // the SNP of each column of columns
+  std::vector<int> prev, next; // the columns from the most to the least recently used
+  int used, head, tail;
+
+  void unlink(int s) {
+    if(prev[s] >= 0) next[prev[s]] = next[s];
+    else if(head == s) head = next[s];
+    if(next[s] >= 0) prev[next[s]] = prev[s];
+    else if(tail == s) tail = prev[s];
+    prev[s] = next[s] = -1;
+  }
+};
+
+/**
+   elnet on the LD columns of a block
+
+   The coordinate descent of elnetCore, cyclic, on Rx = (R (x) I_q) x
+   rather than on yhat.
+
+   @cache the LD columns of the block
+   @scale the factor of R in t(X)*X, i.e. 1 - shrink
+   @r the correlations of the block
+   @x the betas of the block, updated in place
+   @Rx receives (R (x) I_q) x
+   @stats receives the statistics of the call, with the columns found in
+   and computed for the cache
+   @abort when not NULL, ldColumnsCore stops early once it is set, and does
+   not call R
+   @return conv
+
+ */
+template <class Model>
+int ldColumnsCore(const Model& model, double lambda1, double lambda2, LdColumnCache& cache,
+                  double scale, const double* r, double thr, double* x, arma::vec& Rx,
+                  int trace, int maxiter, ElnetStats& stats, const std::atomic<bool>* abort) {
+  int q = model.q();
+  int p = cache.size();
+  int j, k, l, m;
+  double hits = cache.hits, misses = cache.misses;
+
+  // Rx à partir des betas initiaux : seuls les SNPs dont un beta est non nul comptent
+  Rx.zeros();
+  for(j=0; j < p; j++) {
+    const double* col = NULL;
+    for(k=0; k < q; k++) {
+      double a = x[q*j+k];
+      if(a == 0.0) continue;
+      if(col == NULL) col = cache.column(j);
+      for(l=0; l < p; l++) Rx(q*l+k) += a * col[l];
+    }
+  }
+
+  int conv = 0;
+  for(m=0; m < maxiter; m++) {
+    double dlx = 0.0;
+    for(j=0; j < p; j++) {
+      double dj = cache.diag(j);
+      double denom = scale * dj + lambda2;
+      const double* col = NULL;
+      for(k=0; k < q; k++) {
+        int c = q*j+k;
+        double S = scale * (Rx(c) - dj * x[c]);
+        double A = model.t1(q, k, x + q*j, denom) + model.t2(q, k, r + q*j) + model.t3(k, S);
+        double v = 0.0;
+        if (A + lambda1 < 0) v = (A + lambda1)/model.denominator(k, denom);
+        if (A - lambda1 > 0) v = (A - lambda1)/model.denominator(k, denom);
+        double del = v - x[c];
+        if (del == 0.0) continue;
+        x[c] = v;
+        dlx = std::max(dlx, std::abs(del));
+        if(col == NULL) col = cache.column(j);
+        for(l=0; l < p; l++) Rx(q*l+k) += del * col[l];
+      }
+    }
+
+    if(abort == NULL) {
+      Rcpp::checkUserInterrupt();
+      if(trace > 0) Rcpp::Rcout << "Iteration: " << m << "\n";
+    } else if(abort->load()) break;
+
+    if(dlx < thr) {
+      conv = 1;
+      break;
+    }
+  }
+  stats.sweeps = std::min(m + 1, maxiter);
+  stats.ldhits = cache.hits - hits;
+  stats.ldmisses = cache.misses - misses;
+  return conv;
+}
+
+#endif
@@ -0,0 +1,1744 @@
+/**
+   lassosum
+   elnet_path.h
+   Purpose: the paths of runElnet, runElnetBatch and runElnetChunks, shared by
+   the linear and the mixed model
+
+   A problem (ElnetProblem) is set up once on the SNPs read, its blocks being
+   handed to the engines of the other headers: FISTA, one trait at a time,
+   low-rank factors, LD columns, shotgun, the banded LD matrix, the LD cache,
+   single precision, and repelnetCore for the others. solvePath then solves
+   it for every lambda of a shrink. All of it is templated on the model of
+   elnet_core.h, which moreover provides
+
+     bool convex() const                    whether the objective is convex:
+                                            FISTA, the LD cache (solved by
+                                            FISTA) and Anderson acceleration
+                                            need it (see checkConvexity)
+     bool separable() const                 whether nothing couples the traits,
+                                            so that a block may be solved one
+                                            trait at a time (see traitBlocks)
+     Model trait(k) const                   the model of trait k alone
+     arma::mat lossWeights(R) const         the q x p weights W of the linear
+                                            term -2*accu(x % W) of loss, R being
+                                            the correlations as a q x p matrix
+     double fittedQuad(yhat, n, s) const    the quadratic term of loss in the
+                                            fitted values yhat of n subjects,
+                                            s a q x n scratch matrix
+     double ldQuad(xb, R) const             the same from the betas xb (q x p)
+                                            of a block and its LD matrix R
+     double betaQuad(xq, lambda2, s1, s2) const
+                                            the quadratic penalty of fbeta on
+                                            the betas xq (q x p), s1 and s2 q x p
+                                            scratch matrices
+     static const bool snpSd                whether the results hold the sd of
+                                            each SNP (sd) rather than of each
+                                            coefficient (sd_MultiplePheno)
+
+   Each model's file defines GenotypeMatrixMultiplePhenotypes and
+   sd_MultiplePhenotypes, which it exports to R, and the exports which call
+   the bodies below.
+
+ */
+#ifndef LASSOSUM_ELNET_PATH_H
+#define LASSOSUM_ELNET_PATH_H
+
+#include <vector>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <exception>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <RcppArmadillo.h>
+#include "block_scheduler.h"
+#include "elnet_workspace.h"
+#include "elnet_core.h"
+#include "elnet_fista.h"
+#include "elnet_band.h"
+#include "ld_cache.h"
+#include "elnet_float.h"
+#include "elnet_ldcolumns.h"
+#include "elnet_shotgun.h"
+#include "plink_bed.h"
+
+arma::mat GenotypeMatrixMultiplePhenotypes(const arma::mat& GenotypeMatrix, int q);
+arma::vec sd_MultiplePhenotypes(const arma::vec& sd, int q);
+
+// The options of runElnet (see its documentation), with its defaults
+struct ElnetOptions {
+  int nthreads;
+  int scheme;
+  int anderson;
+  double gaptol;
+  int engine;
+  int fistasize;
+  bool joint;
+  bool sparse;
+  bool keeppred;
+  double maf;
+  double callrate;
+  double lowrank;
+  arma::Col<int> windowend;
+  double ldthr;
+  std::string ldcache;
+  int ldprecision;
+  bool single;
+  bool polish;
+  double ldmemory;
+  int shotgun;
+  int shotgunwindow;
+  double shotgunthr;
+
+  ElnetOptions() :
+    nthreads(1), scheme(1), anderson(0), gaptol(0.0), engine(0), fistasize(1000),
+    joint(false), sparse(false), keeppred(true), maf(0.0), callrate(0.0), lowrank(0.0),
+    ldthr(0.0), ldprecision(0), single(false), polish(true), ldmemory(4e9), shotgun(0),
+    shotgunwindow(200), shotgunthr(0.1) {}
+
+  ElnetControl control() const { return ElnetControl(scheme, anderson, gaptol, joint); }
+};
+
+// FISTA, the LD cache and Anderson acceleration are only used on a convex model:
+// FISTA converges to the minimum of a convex objective only, and the cache is
+// solved by FISTA. A decrease of a nonconvex objective does not make an
+// Anderson extrapolation safe either.
+template <class Model>
+void checkConvexity(const Model& model, const ElnetOptions& opt)
+{
+  if(model.convex()) return;
+  if(opt.engine == 1 || opt.engine == 2)
+    throw std::runtime_error("FISTA needs a convex model: use engine 0 or 3");
+  if(opt.anderson > 0)
+    throw std::runtime_error("Anderson acceleration needs a convex model");
+  if(!opt.ldcache.empty())
+    throw std::runtime_error("The LD cache is solved by FISTA, which needs a convex model");
+}
+
+// Solves the blocks marked in fista by FISTA on their LD matrix (see
+// elnet_fista.h), for every lambda at once, starting from the betas in x.
+// G is the standardized genotype matrix for one phenotype, and the LD matrix
+// that of G scaled by sqrt(1 - lambda2) as in runElnet. When ld is not NULL,
+// the unscaled LD matrix of each block is kept in it, to be reused by the
+// next call (the next shrink). When cache is not NULL, the unscaled LD
+// matrices are read from it rather than computed from G. The solutions are
+// written to the columns of beta, the number of iterations to sweeps and the
+// convergence to conv. A block for which FISTA does not apply is unmarked, to
+// be solved by elnet. abort is as in repelnetCore. Each thread keeps its
+// scratch space (see FistaWorkspace), sized for the largest block marked,
+// from one block to the next.
+
+template <class Model>
+void fistaBlocks(const arma::vec& lambda, double lambda2, arma::mat& G, const arma::vec& r,
+                 const Model& model, const arma::vec& x, double tol, int maxiter,
+                 const arma::Col<int>& startvec, const arma::Col<int>& endvec,
+                 std::vector<char>& fista, int nthreads, int trace, arma::mat& beta,
+                 arma::Mat<int>& sweeps, arma::Mat<int>& conv, std::vector<arma::mat>* ld,
+                 const LdCache* cache, const std::atomic<bool>* abort)
+{
+  int q = model.q();
+  int nl = lambda.n_elem;
+
+  // The objective in the notations of elnet_gap.h, b being t2
+  arma::vec D;
+  arma::mat P;
+  if(!model.gap(q, lambda2, D, P)) throw std::runtime_error("FISTA needs a convex model");
+
+  // Les statistiques et l'espace de travail de chaque thread, réutilisés d'un
+  // bloc à l'autre
+  int maxp = 0;
+  for(int i=0; i < (int) startvec.n_elem; i++)
+    if(fista[i]) maxp = std::max(maxp, (endvec(i) - startvec(i) + 1) / q);
+  std::vector<std::vector<ElnetStats> > threadstats(std::max(nthreads, 1),
+                                                    std::vector<ElnetStats>(nl));
+  std::vector<std::vector<int> > threadconv(std::max(nthreads, 1), std::vector<int>(nl));
+  std::vector<FistaWorkspace> threadws(std::max(nthreads, 1), FistaWorkspace(maxp, q, nl));
+
+  auto solve = [&](int i, int thread, const std::atomic<bool>* abort) {
+    int j0 = startvec(i) / q;
+    int p = (endvec(i) - startvec(i) + 1) / q;
+    FistaWorkspace& fw = threadws[thread];
+    arma::mat R(fw.R.memptr(), p, p, false, true);
+    if(ld != NULL && (*ld)[i].n_elem > 0) {
+      R = (*ld)[i];
+    } else if(cache != NULL) {
+      cache->ld(i, R);
+    } else {
+      arma::mat Gtouse(G.colptr(j0), G.n_rows, p, false, true);
+      R = Gtouse.t() * Gtouse;
+    }
+    if(ld != NULL && (*ld)[i].n_elem == 0) (*ld)[i] = R;
+    R *= 1.0 - lambda2;
+
+    arma::mat b(fw.b.memptr(), p, q, false, true);
+    arma::mat B(fw.B.memptr(), p, q*nl, false, true);
+    for(int j=0; j < p; j++) {
+      for(int k=0; k < q; k++) {
+        b(j,k) = model.t2(q, k, r.memptr() + q*(j0+j));
+        for(int l=0; l < nl; l++) B(j,l*q+k) = x(q*(j0+j)+k);
+      }
+    }
+
+    std::vector<ElnetStats>& stats = threadstats[thread];
+    std::vector<int>& convl = threadconv[thread];
+    if(!fistaBlock(R, b, D, P, lambda, tol, maxiter, B, stats, convl, abort, fw)) {
+      fista[i] = 0;
+      return;
+    }
+    for(int l=0; l < nl; l++) {
+      for(int j=0; j < p; j++)
+        for(int k=0; k < q; k++) beta(q*(j0+j)+k, l) = B(j,l*q+k);
+      sweeps(i,l) = stats[l].sweeps;
+      conv(i,l) = convl[l];
+    }
+  };
+
+  runMarkedBlocks(startvec, endvec, [&](int i) { return fista[i] != 0; }, nthreads, trace,
+                  abort, solve);
+}
+
+// Solves the blocks marked in bytrait one trait at a time. When the model is
+// separable, nothing couples the traits (t1 is zero and t2, t3 only involve
+// trait k), so that elnet on a block is q independent elnet problems with
+// q = 1 on G, the genotype matrix for one phenotype, scaled as in runElnet:
+// n rows instead of n*q. Every (block, trait) pair is a task of its own, so
+// that the threads are kept busy even with few blocks. The betas are updated
+// in x; the fitted values are left to repelnetCore (see presolved). stats
+// receives, for each block, the largest number of sweeps of its traits and
+// the sum of the other statistics; taskstats and taskconv are the scratch
+// space of the tasks, kept by the caller from one lambda to the next. abort
+// is as in repelnetCore.
+
+template <class Model>
+void traitBlocks(double lambda1, double lambda2, arma::mat& G, const arma::vec& diag,
+                 const arma::vec& r, const Model& model, double thr, arma::vec& x, int trace,
+                 int maxiter, const arma::Col<int>& startvec, const arma::Col<int>& endvec,
+                 const std::vector<char>& bytrait, int nthreads, const ElnetControl& ctrl,
+                 std::vector<ElnetWorkspace>& ws, std::vector<ElnetStats>& stats,
+                 std::vector<int>& conv, std::vector<ElnetStats>& taskstats,
+                 std::vector<int>& taskconv, const std::atomic<bool>* abort)
+{
+  int q = model.q();
+  int nreps = startvec.n_elem;
+  taskstats.assign(nreps*q, ElnetStats());
+  taskconv.assign(nreps*q, 1);
+
+  // Task q*i+k is trait k of block i. Its betas, correlations and diag are
+  // strided in x, r and diag: they are copied to the workspace and back.
+  auto solve = [&](int t, int thread, const std::atomic<bool>* abort) {
+    int i = t / q, k = t % q;
+    int j0 = startvec(i) / q;
+    int p = (endvec(i) - startvec(i) + 1) / q;
+    ElnetWorkspace& w = ws[thread];
+    arma::mat Gtouse(G.colptr(j0), G.n_rows, p, false, true);
+    arma::vec rtouse = workspaceView(w.traitr, p);
+    arma::vec diagtouse = workspaceView(w.traitdiag, p);
+    arma::vec xtouse = workspaceView(w.traitx, p);
+    for(int j=0; j < p; j++) {
+      rtouse.at(j) = r.at(q*(j0+j)+k);
+      diagtouse.at(j) = diag.at(q*(j0+j)+k);
+      xtouse.at(j) = x.at(q*(j0+j)+k);
+    }
+    arma::vec yhattouse = workspaceView(w.yhat, G.n_rows);
+    yhattouse = Gtouse * xtouse;
+
+    taskconv[t] = elnetCore<Model, 1>(model.trait(k), lambda1, lambda2, diagtouse, Gtouse,
+                                      rtouse, thr, xtouse, yhattouse, trace - 1, maxiter,
+                                      ctrl, w, taskstats[t], abort);
+    for(int j=0; j < p; j++) x.at(q*(j0+j)+k) = xtouse.at(j);
+  };
+
+  runMarkedBlocks(startvec, endvec, [&](int i) { return bytrait[i] != 0; }, nthreads, trace,
+                  abort, solve, q);
+
+  for(int i=0; i < nreps; i++) {
+    if(!bytrait[i]) continue;
+    stats[i] = ElnetStats();
+    conv[i] = 1;
+    for(int k=0; k < q; k++) {
+      const ElnetStats& st = taskstats[q*i+k];
+      stats[i].sweeps = std::max(stats[i].sweeps, st.sweeps);
+      stats[i].extrapolations += st.extrapolations;
+      stats[i].screened += st.screened;
+      conv[i] = std::min(conv[i], taskconv[q*i+k]);
+    }
+  }
+}
+
+// Solves the blocks marked in lowrank on their low-rank factors (see
+// lowrankFactors): X holds, for each of these blocks, its factor scaled as in
+// runElnet and expanded to multiple phenotypes, and diag diag(X'X). elnet
+// then goes through k*q rows rather than n*q for each update, k being the
+// rank of the factor. The betas are updated in x; the fitted values, on the
+// genotypes rather than on the factors, are left to repelnetCore (see
+// presolved). abort is as in repelnetCore.
+
+template <class Model>
+void lowrankBlocks(double lambda1, double lambda2, std::vector<arma::mat>& X,
+                   const std::vector<arma::vec>& diag, const arma::vec& r,
+                   const Model& model, ElnetCoreFn<Model> core,
+                   double thr, arma::vec& x, int trace, int maxiter,
+                   const arma::Col<int>& startvec, const arma::Col<int>& endvec,
+                   const std::vector<char>& lowrank, int nthreads,
+                   const ElnetControl& ctrl, std::vector<ElnetWorkspace>& ws,
+                   std::vector<ElnetStats>& stats, std::vector<int>& conv,
+                   const std::atomic<bool>* abort)
+{
+  auto solve = [&](int i, int thread, const std::atomic<bool>* abort) {
+    int len = endvec(i) - startvec(i) + 1;
+    ElnetWorkspace& w = ws[thread];
+    arma::vec rtouse = workspaceView(w.traitr, len);
+    arma::vec xtouse = workspaceView(w.traitx, len);
+    rtouse = r.subvec(startvec(i), endvec(i));
+    xtouse = x.subvec(startvec(i), endvec(i));
+    arma::vec yhattouse = workspaceView(w.yhat, X[i].n_rows);
+    yhattouse = X[i] * xtouse;
+
+    conv[i] = core(model, lambda1, lambda2, diag[i], X[i], rtouse, thr, xtouse, yhattouse,
+                   trace - 1, maxiter, ctrl, w, stats[i], abort);
+    x.subvec(startvec(i), endvec(i)) = xtouse;
+  };
+
+  runMarkedBlocks(startvec, endvec, [&](int i) { return lowrank[i] != 0; }, nthreads, trace,
+                  abort, solve);
+}
+
+// Solves the blocks on G, the standardized genotypes for one phenotype in
+// single precision (see floatCore), whose squared column norms are d. With
+// polish, each block is then solved again from its solution with the fitted
+// values and the cross products in double precision, which usually takes a
+// sweep or two. The betas are updated in x. abort is as in repelnetCore.
+
+template <class Model>
+void floatBlocks(double lambda1, double lambda2, const arma::fmat& G, const arma::vec& d,
+                 const arma::vec& r, const Model& model, double thr, arma::vec& x,
+                 int trace, int maxiter, const arma::Col<int>& startvec,
+                 const arma::Col<int>& endvec, bool polish, int nthreads,
+                 std::vector<ElnetWorkspace>& ws, std::vector<ElnetStats>& stats,
+                 std::vector<int>& conv, const std::atomic<bool>* abort)
+{
+  int nq = model.q();
+  int n = G.n_rows;
+
+  auto solve = [&](int i, int thread, const std::atomic<bool>* abort) {
+    int j0 = startvec(i) / nq;
+    int p = (endvec(i) - startvec(i) + 1) / nq;
+    ElnetWorkspace& w = ws[thread];
+    if(w.fyhat.n_elem < n * nq) w.fyhat.set_size(n * nq);
+    conv[i] = floatCore<float>(model, lambda1, lambda2, G, j0, p, d, 1.0 - lambda2,
+                               r.memptr() + startvec(i), thr, x.memptr() + startvec(i),
+                               w.fyhat.memptr(), trace - 1, maxiter, stats[i], abort);
+    if(polish && (abort == NULL || !abort->load())) {
+      conv[i] = floatCore<double>(model, lambda1, lambda2, G, j0, p, d, 1.0 - lambda2,
+                                  r.memptr() + startvec(i), thr, x.memptr() + startvec(i),
+                                  w.yhat.memptr(), trace - 1, maxiter, stats[i], abort);
+    }
+  };
+
+  runMarkedBlocks(startvec, endvec, [&](int i) { return endvec(i) >= startvec(i); }, nthreads,
+                  trace, abort, solve);
+}
+
+// Solves the blocks marked in lazy on the columns of their LD matrices,
+// computed on demand into the caches columns (see elnet_ldcolumns.h). The
+// betas are updated in x; the fitted values are left to repelnetCore (see
+// presolved). abort is as in repelnetCore.
+
+template <class Model>
+void ldColumnsBlocks(double lambda1, double lambda2, std::vector<LdColumnCache>& columns,
+                     const arma::vec& r, const Model& model, double thr, arma::vec& x,
+                     int trace, int maxiter, const arma::Col<int>& startvec,
+                     const arma::Col<int>& endvec, const std::vector<char>& lazy,
+                     int nthreads, std::vector<ElnetWorkspace>& ws,
+                     std::vector<ElnetStats>& stats, std::vector<int>& conv,
+                     const std::atomic<bool>* abort)
+{
+  auto solve = [&](int i, int thread, const std::atomic<bool>* abort) {
+    int len = endvec(i) - startvec(i) + 1;
+    ElnetWorkspace& w = ws[thread];
+    if(w.Rx.n_elem < len) w.Rx.set_size(len);
+    arma::vec Rx = workspaceView(w.Rx, len);
+    conv[i] = ldColumnsCore(model, lambda1, lambda2, columns[i], 1.0 - lambda2,
+                            r.memptr() + startvec(i), thr, x.memptr() + startvec(i), Rx,
+                            trace - 1, maxiter, stats[i], abort);
+  };
+
+  runMarkedBlocks(startvec, endvec, [&](int i) { return lazy[i] != 0; }, nthreads, trace,
+                  abort, solve);
+}
+
+// Solves the blocks marked in shotgun one after the other, each with nthreads
+// threads (see elnet_shotgun.h), on G, the standardized genotypes for one
+// phenotype of the SNPs kept, in the batches of plans. The betas are updated
+// in x; the fitted values are left to repelnetCore (see presolved). abort is
+// as in repelnetCore.
+
+template <class Model>
+void shotgunBlocks(double lambda1, double lambda2, const arma::mat& G,
+                   const std::vector<ShotgunPlan>& plans, const arma::vec& r,
+                   const Model& model, double thr, arma::vec& x, int trace,
+                   int maxiter, const arma::Col<int>& startvec, const arma::Col<int>& endvec,
+                   const std::vector<char>& shotgun, int nthreads,
+                   std::vector<ElnetWorkspace>& ws, std::vector<ElnetStats>& stats,
+                   std::vector<int>& conv, const std::atomic<bool>* abort)
+{
+  int nq = model.q();
+  auto solve = [&](int i, int thread, const std::atomic<bool>* abort) {
+    conv[i] = shotgunCore(model, lambda1, lambda2, G, startvec(i) / nq, plans[i], 1.0 - lambda2,
+                          r.memptr() + startvec(i), thr, x.memptr() + startvec(i), ws[0],
+                          nthreads, trace - 1, maxiter, stats[i], abort);
+  };
+
+  // Les threads servent à l'intérieur de chaque bloc
+  runMarkedBlocks(startvec, endvec, [&](int i) { return shotgun[i] != 0; }, 1, trace, abort,
+                  solve);
+}
+
+// A problem of runElnet: the correlations, model and initial betas of a set of
+// traits, with all that does not depend on the shrink. Only the SNPs kept by
+// the SnpFilter are solved by elnet, the others being scattered back to their
+// position among all the SNPs in the results.
+template <class Model>
+struct ElnetProblem {
+  Model model;
+  arma::vec r;                // of the SNPs kept
+  arma::vec x;                // the initial betas of the SNPs kept, then those of the next shrink
+  arma::vec rall;             // r of every SNP
+  arma::uvec kept;            // the SNPs kept and those of zero variance (see SnpFilter)
+  arma::uvec constant;
+  arma::vec xconstant;        // the betas of the SNPs of zero variance, as x
+  arma::vec sd_MultiplePheno; // of every SNP
+  arma::Col<int> startvec;    // the blocks, over the SNPs kept
+  arma::Col<int> endvec;
+  std::vector<char> fista;     // the blocks solved by FISTA (see fistaBlocks)
+  std::vector<char> bytrait;   // the blocks solved one trait at a time (see traitBlocks)
+  std::vector<char> presolved; // the blocks left out of repelnetCore
+  bool anyfista;
+  arma::mat lossweights;       // the weights of r in loss (see lossWeights), q x p
+  std::vector<arma::mat> ld;   // the LD matrices of the FISTA blocks, kept for the next shrinks
+  std::vector<char> lowrank;   // the blocks solved on a low-rank factor (see lowrankFactors)
+  std::vector<arma::mat> factor; // their factors
+  arma::sp_mat band;           // the banded LD matrix of the SNPs kept (see bandProblem)
+  int window;                  // the width of the windows of bandCore, 0 without band
+  const LdCache* ldcache;      // if not NULL, G is not read: the blocks are solved by FISTA
+                               // on the LD matrices of this cache (see ldCacheProblem)
+  const arma::fmat* fgenotypes; // if not NULL, G is read in single precision, into this
+                                // matrix, and the blocks are solved by floatBlocks
+  arma::vec fdiag;             // the squared norms of its columns
+  bool polish;                 // see floatBlocks
+  std::vector<char> lazy;      // the blocks solved on their LD columns (see ldColumnsProblem)
+  std::vector<LdColumnCache> columns; // their caches, kept for the next lambdas and shrinks
+  std::vector<char> shotgun;   // the blocks solved with several threads (see shotgunProblem)
+  std::vector<ShotgunPlan> plans; // their batches
+
+  explicit ElnetProblem(const Model& model) : model(model) {}
+};
+
+// The results of a problem for one shrink, as returned by runElnet
+struct ElnetPath {
+  arma::vec out;
+  arma::mat pred;
+  arma::vec loss;
+  arma::vec fbeta;
+  arma::mat beta;
+  std::vector<arma::uword> betarows;
+  std::vector<double> betavalues;
+  arma::uvec betacolptr;
+  arma::Col<int> nparams;
+  arma::Mat<int> sweeps;
+  arma::Mat<int> extrapolations;
+  arma::Mat<int> screened;
+  arma::mat ldhits;
+  arma::mat ldmisses;
+  arma::vec time;
+};
+
+// Whether FISTA can solve a block of p SNPs on its LD matrix, of nsubjects
+// subjects: beyond nsubjects SNPs the matrix is singular by construction and
+// FISTA converges badly, and the p x p matrix must fit in fistamemory bytes
+inline bool fistaAffordable(double p, int nsubjects, double fistamemory)
+{
+  return p <= nsubjects && 8.0 * p * p <= fistamemory;
+}
+
+// Sets up a problem of runElnet on the SNPs read through filter, with the
+// blocks (over all the SNPs) and engine options of runElnet. With engine 2,
+// a block is only left to FISTA if fistaAffordable.
+template <class Model>
+ElnetProblem<Model> elnetProblem(const Model& model, const arma::mat& cor,
+                                 const arma::mat& init, const SnpFilter& filter,
+                                 const arma::Col<int>& startvec, const arma::Col<int>& endvec,
+                                 int engine, int fistasize, int nsubjects, double fistamemory)
+{
+  ElnetProblem<Model> pb(model);
+  int j, k, t;
+  int nq = model.q();
+  int nsnps = filter.sd.n_elem;
+  pb.kept = filter.kept;
+  pb.constant = filter.constant;
+
+  // On construit le vecteur sd pour plusieurs phenotypes
+  pb.sd_MultiplePheno = sd_MultiplePhenotypes(filter.sd,nq);
+
+  // Ici, je transforme cor et init en des vecteurs pour pouvoir travailler avec :
+
+  pb.rall = arma::vec(cor.n_rows*cor.n_cols,arma::fill::zeros);
+  int b = 0;
+  for(int a=0; a < pb.rall.n_elem; a+=cor.n_rows) {
+    pb.rall.subvec(a,a+cor.n_rows-1) = cor.col(b);
+    b=b+1;
+  }
+
+  arma::vec xall(init.n_rows*init.n_cols,arma::fill::zeros);
+  int q = 0;
+  for(int e=0; e < xall.n_elem; e+=init.n_rows) {
+    xall.subvec(e,e+init.n_rows-1) = init.col(q);
+    q=q+1;
+  }
+
+  if (nsnps * nq != pb.rall.n_elem) {
+    throw std::runtime_error("Number of positions in reference file is not "
+                               "equal the number of regression coefficients");
+  }
+
+  pb.r.set_size(nq * pb.kept.n_elem);
+  pb.x.set_size(nq * pb.kept.n_elem);
+  for(t=0; t < pb.kept.n_elem; t++) {
+    for(k=0; k < nq; k++) {
+      pb.r(nq*t+k) = pb.rall(nq*pb.kept(t)+k);
+      pb.x(nq*t+k) = xall(nq*pb.kept(t)+k);
+    }
+  }
+  pb.xconstant.set_size(nq * pb.constant.n_elem);
+  for(t=0; t < pb.constant.n_elem; t++) {
+    for(k=0; k < nq; k++) pb.xconstant(nq*t+k) = xall(nq*pb.constant(t)+k);
+  }
+
+  // Column c of the genotype matrix over all the SNPs becomes the first column
+  // at or after c of the one over the SNPs kept. A block may become empty.
+  std::vector<char> iskept(nsnps, 0);
+  std::vector<int> nkept(nsnps + 1, 0);
+  for(t=0; t < pb.kept.n_elem; t++) iskept[pb.kept(t)] = 1;
+  for(j=0; j < nsnps; j++) nkept[j+1] = nkept[j] + iskept[j];
+  auto keptColumn = [&](int c) {
+    int j = c / nq;
+    return nq*nkept[j] + ((j < nsnps && iskept[j]) ? c % nq : 0);
+  };
+  pb.startvec.set_size(startvec.n_elem);
+  pb.endvec.set_size(startvec.n_elem);
+  for(j=0; j < startvec.n_elem; j++) {
+    pb.startvec(j) = keptColumn(startvec(j));
+    pb.endvec(j) = keptColumn(endvec(j) + 1) - 1;
+  }
+
+  // The blocks solved by FISTA are solved first, for all lambdas at once, into beta.
+  // Their time is shared between the lambdas.
+  pb.fista.assign(startvec.n_elem, 0);
+  pb.anyfista = false;
+  for(j=0; j < startvec.n_elem; j++) {
+    int len = pb.endvec(j) - pb.startvec(j) + 1;
+    if(len == 0 || pb.startvec(j) % nq != 0 || len % nq != 0) continue;
+    double p = len / nq;
+    bool autofista = (p >= fistasize && fistaAffordable(p, nsubjects, fistamemory));
+    pb.fista[j] = (engine == 1 || (engine == 2 && autofista));
+    pb.anyfista = pb.anyfista || pb.fista[j];
+  }
+
+  // When the model is separable, the traits of the other blocks are solved as
+  // independent problems (see traitBlocks); repelnetCore then only adds their
+  // fitted values. It has nothing to do for an empty block.
+  pb.bytrait.assign(startvec.n_elem, 0);
+  pb.presolved = pb.fista;
+  bool separable = (nq > 1 && model.separable());
+  for(j=0; j < startvec.n_elem; j++) {
+    int len = pb.endvec(j) - pb.startvec(j) + 1;
+    pb.bytrait[j] = (separable && len > 0 && !pb.fista[j] && pb.startvec(j) % nq == 0 &&
+                     len % nq == 0);
+    pb.presolved[j] = pb.presolved[j] || pb.bytrait[j] || len == 0;
+  }
+
+  // The quadratic forms of loss and fbeta are block diagonal, with one q x q block
+  // per subject or per SNP: they are computed on yhat, x and r seen as q x n and
+  // q x p matrices (trait by subject or SNP), rather than with kron() matrices,
+  // of which kron(I_n, inv_Ss) alone has (n*q)^2 elements. The weights of r do
+  // not depend on lambda.
+  pb.lossweights = model.lossWeights(arma::mat(pb.rall.memptr(), nq, nsnps, false, true));
+  pb.ld.resize(startvec.n_elem);
+  pb.lowrank.assign(startvec.n_elem, 0);
+  pb.factor.resize(startvec.n_elem);
+  pb.window = 0;
+  pb.ldcache = NULL;
+  pb.fgenotypes = NULL;
+  pb.polish = false;
+  pb.lazy.assign(startvec.n_elem, 0);
+  pb.columns.resize(startvec.n_elem);
+  pb.shotgun.assign(startvec.n_elem, 0);
+  pb.plans.resize(startvec.n_elem);
+  return pb;
+}
+
+// The key of the LD cache of a run of runElnet (see ld_cache.h), from the
+// identity of the .bed file, the selection of subjects and SNPs and the
+// blocks, over the SNPs rather than the coefficients so that problems of any
+// number of phenotypes share it. Returns false if the file cannot be found,
+// or if a block does not hold whole SNPs: there is then no cache.
+
+inline bool ldCacheKey(const std::string& fileName, int N, int P,
+                       const arma::Col<int>& col_skip_pos, const arma::Col<int>& col_skip,
+                       const arma::Col<int>& keepbytes, const arma::Col<int>& keepoffset,
+                       double maf, double callrate, const arma::Col<int>& startvec,
+                       const arma::Col<int>& endvec, int nq, uint64_t& key)
+{
+  LdCacheKey k;
+  if(!k.addFile(fileName)) return false;
+  k.add(N);
+  k.add(P);
+  k.add(col_skip_pos);
+  k.add(col_skip);
+  k.add(keepbytes);
+  k.add(keepoffset);
+  k.add(maf);
+  k.add(callrate);
+  arma::Col<int> start(startvec.n_elem), end(startvec.n_elem);
+  for(int j=0; j < startvec.n_elem; j++) {
+    if(startvec(j) % nq != 0 || (endvec(j) + 1) % nq != 0) return false;
+    start(j) = startvec(j) / nq;
+    end(j) = (endvec(j) + 1) / nq - 1;
+  }
+  k.add(start);
+  k.add(end);
+  key = k.value;
+  return true;
+}
+
+// Writes the LD matrices of the blocks of pb, on G, the standardized genotypes
+// of the SNPs kept whose means before standardization are means, to the LD
+// cache fileName (see writeLdCache).
+
+template <class Model>
+void writeProblemLdCache(const std::string& fileName, uint64_t key, int precision,
+                         const ElnetProblem<Model>& pb, const SnpFilter& filter, arma::mat& G,
+                         const arma::vec& means)
+{
+  int nq = pb.model.q();
+  int nblocks = pb.startvec.n_elem;
+  arma::Col<int> start(nblocks), blocksize(nblocks);
+  for(int j=0; j < nblocks; j++) {
+    start(j) = pb.startvec(j) / nq;
+    blocksize(j) = (pb.endvec(j) - pb.startvec(j) + 1) / nq;
+  }
+  bool ok = writeLdCache(fileName, key, precision, G.n_rows, filter.sd, means, pb.kept,
+                         pb.constant, start, blocksize, [&](int i) {
+    arma::mat Gtouse(G.colptr(start(i)), G.n_rows, blocksize(i), false, true);
+    return arma::mat(Gtouse.t() * Gtouse);
+  });
+  if(!ok)
+    Rcpp::Rcerr << "Warning, the LD cache " << fileName << " could not be written" << std::endl;
+}
+
+// Solves every block of pb by FISTA on its LD matrix in cache, G not having
+// been read. The blocks being solved on their LD only, there are no fitted
+// values: loss is then computed from the LD of the blocks. Every block must
+// be fistaAffordable (see runElnetCore, which checks it before reading
+// anything).
+
+template <class Model>
+void ldCacheProblem(ElnetProblem<Model>& pb, const LdCache& cache, double fistamemory)
+{
+  int nq = pb.model.q();
+  pb.anyfista = false;
+  for(int j=0; j < pb.startvec.n_elem; j++) {
+    int len = pb.endvec(j) - pb.startvec(j) + 1;
+    if(len > 0 && !fistaAffordable(len / nq, cache.nsubjects(), fistamemory)) {
+      throw std::runtime_error("Block " + std::to_string(j + 1) + " of the LD cache cannot be "
+                               "solved by FISTA: run it without ldcache");
+    }
+    pb.fista[j] = (len > 0);
+    pb.bytrait[j] = 0;
+    pb.presolved[j] = 1;
+    pb.anyfista = pb.anyfista || pb.fista[j];
+  }
+  pb.ldcache = &cache;
+}
+
+// Replaces the genotypes of the blocks of pb solved by elnet (not by FISTA)
+// with a low-rank factor F = S_k V_k', from the thin SVD G_b = U S V' of the
+// standardized genotypes of the block, keeping the k largest singular values
+// which account for fraction of sum(S^2), i.e. of the variance of G_b: F'F
+// approximates the LD matrix G_b'G_b of the block with k rows instead of n.
+// A block stays on its genotypes when k is not below n. The blocks with a
+// factor are solved by lowrankBlocks, rather than by traitBlocks or
+// repelnetCore.
+
+template <class Model>
+void lowrankFactors(ElnetProblem<Model>& pb, arma::mat& G, double fraction, int nthreads)
+{
+  int nq = pb.model.q();
+  int nblocks = pb.startvec.n_elem;
+  if(fraction <= 0.0) return;
+
+  auto factorize = [&](int i) {
+    int j0 = pb.startvec(i) / nq;
+    int p = (pb.endvec(i) - pb.startvec(i) + 1) / nq;
+    arma::mat Gtouse(G.colptr(j0), G.n_rows, p, false, true);
+    arma::mat U, V;
+    arma::vec s;
+    if(!arma::svd_econ(U, s, V, Gtouse, "right")) return;
+    double total = arma::accu(s % s), sum = 0.0;
+    int k = 0;
+    while(k < (int) s.n_elem && sum < fraction * total) {
+      sum += s(k) * s(k);
+      k++;
+    }
+    if(k == 0 || k >= (int) G.n_rows) return;
+    pb.factor[i] = V.cols(0, k - 1).t();
+    for(int h=0; h < k; h++) pb.factor[i].row(h) *= s(h);
+    pb.lowrank[i] = 1;
+  };
+
+  std::vector<int> order;
+  std::vector<int> bysize = blocksLargestFirst(pb.startvec, pb.endvec);
+  for(size_t t=0; t < bysize.size(); t++) {
+    int i = bysize[t];
+    int len = pb.endvec(i) - pb.startvec(i) + 1;
+    if(len > 0 && !pb.fista[i] && !pb.shotgun[i] && pb.startvec(i) % nq == 0 && len % nq == 0)
+      order.push_back(i);
+  }
+  if(nthreads > 1 && order.size() > 1) {
+    runBlocks(order.size(), order, nthreads, 0,
+              [&](int i, int thread, const std::atomic<bool>& abort) { factorize(i); });
+  } else {
+    for(size_t t=0; t < order.size(); t++) factorize(order[t]);
+  }
+
+  for(int i=0; i < nblocks; i++) {
+    if(!pb.lowrank[i]) continue;
+    pb.bytrait[i] = 0;
+    pb.presolved[i] = 1;
+  }
+}
+
+// Solves the blocks of pb solved by elnet on the columns of their LD matrix,
+// from G, the standardized genotypes of the SNPs kept, computed as they are
+// needed (see ldColumnsBlocks). The caches of the columns of all the blocks
+// take at most memory bytes, shared between the blocks by number of SNPs.
+
+template <class Model>
+void ldColumnsProblem(ElnetProblem<Model>& pb, const arma::mat& G, double memory)
+{
+  int nq = pb.model.q();
+  for(int j=0; j < pb.startvec.n_elem; j++) {
+    int len = pb.endvec(j) - pb.startvec(j) + 1;
+    if(len == 0 || pb.fista[j] || pb.lowrank[j] || pb.shotgun[j] || pb.startvec(j) % nq != 0 ||
+       len % nq != 0)
+      continue;
+    pb.lazy[j] = 1;
+    pb.bytrait[j] = 0;
+    pb.presolved[j] = 1;
+    pb.columns[j] = LdColumnCache(G, pb.startvec(j) / nq, len / nq,
+                                  memory * len / std::max((int) pb.r.n_elem, 1));
+  }
+}
+
+// Solves the blocks of pb of at least minsize SNPs by shotgunBlocks, with all
+// the threads, rather than by FISTA or elnet, on G, the standardized genotypes
+// of the SNPs kept. Their batches hold no two SNPs within window SNPs of each
+// other with a correlation of ldthr or more in absolute value (see
+// shotgunPlan). To be called before lowrankFactors and ldColumnsProblem,
+// which leave these blocks alone.
+
+template <class Model>
+void shotgunProblem(ElnetProblem<Model>& pb, const arma::mat& G, int minsize, int window,
+                    double ldthr, int nthreads)
+{
+  int nq = pb.model.q();
+  if(minsize <= 0) return;
+  pb.anyfista = false;
+  for(int j=0; j < pb.startvec.n_elem; j++) {
+    int len = pb.endvec(j) - pb.startvec(j) + 1;
+    if(len > 0 && len / nq >= minsize && pb.startvec(j) % nq == 0 && len % nq == 0) {
+      pb.shotgun[j] = 1;
+      pb.fista[j] = 0;
+      pb.bytrait[j] = 0;
+      pb.presolved[j] = 1;
+      pb.plans[j] = shotgunPlan(G, pb.startvec(j) / nq, len / nq, window, ldthr, nthreads);
+    }
+    pb.anyfista = pb.anyfista || pb.fista[j];
+  }
+}
+
+// Solves the blocks of pb by floatBlocks, on G, the standardized genotypes
+// of the SNPs kept in single precision, which must outlive pb. FISTA, the
+// blocks by trait and the other options of elnet are then not used.
+
+template <class Model>
+void singleProblem(ElnetProblem<Model>& pb, const arma::fmat& G, bool polish)
+{
+  int nq = pb.model.q();
+  for(int j=0; j < pb.startvec.n_elem; j++) {
+    int len = pb.endvec(j) - pb.startvec(j) + 1;
+    if(len > 0 && (pb.startvec(j) % nq != 0 || len % nq != 0))
+      throw std::runtime_error("Single precision needs blocks of whole SNPs");
+    pb.fista[j] = 0;
+    pb.bytrait[j] = 0;
+    pb.presolved[j] = 1;
+  }
+  pb.anyfista = false;
+  pb.fdiag.set_size(G.n_cols);
+  for(int j=0; j < G.n_cols; j++) {
+    const float* g = G.colptr(j);
+    double s = 0.0;
+    for(int i=0; i < G.n_rows; i++) s += (double) g[i] * g[i];
+    pb.fdiag(j) = s;
+  }
+  pb.fgenotypes = &G;
+  pb.polish = polish;
+}
+
+// Solves pb over all the SNPs kept, without blocks, on their banded LD matrix
+// (see bandedLD and bandCore): windowend(j) is the last SNP, over every SNP,
+// within the window of SNP j, and the correlations below ldthr in absolute
+// value are dropped. The windows of bandCore are as wide as the widest of
+// these windows. The blocks, FISTA and the low-rank factors are then not used.
+
+template <class Model>
+void bandProblem(ElnetProblem<Model>& pb, arma::mat& G, const arma::Col<int>& windowend,
+                 double ldthr, int nthreads)
+{
+  int nkept = pb.kept.n_elem;
+  int t;
+  if(windowend.n_elem == 0) return;
+
+  // The last SNP kept within the window of each SNP kept
+  arma::Col<int> end(nkept);
+  pb.window = 1;
+  for(t=0; t < nkept; t++) {
+    arma::uword last = windowend(pb.kept(t));
+    end(t) = std::upper_bound(pb.kept.begin(), pb.kept.end(), last) - pb.kept.begin() - 1;
+    end(t) = std::max(end(t), t);
+    pb.window = std::max(pb.window, end(t) - t + 1);
+  }
+  pb.band = bandedLD(G, end, ldthr, nthreads);
+
+  std::fill(pb.fista.begin(), pb.fista.end(), 0);
+  std::fill(pb.bytrait.begin(), pb.bytrait.end(), 0);
+  std::fill(pb.lowrank.begin(), pb.lowrank.end(), 0);
+  std::fill(pb.shotgun.begin(), pb.shotgun.end(), 0);
+  pb.anyfista = false;
+}
+
+// Solves a problem for every lambda at one shrink, on G, the standardized
+// genotype matrix for one phenotype of the SNPs kept, starting from the betas
+// in pb.x. The betas of the first lambda are left in pb.x for the next shrink,
+// and the LD matrices of the FISTA blocks in pb.ld if keepld. abort is as in
+// repelnetCore: then nothing here calls R, and the path stops early once
+// abort is set. With a banded LD matrix (pb.window > 0), the SNPs are solved
+// by bandCore, and the path.sweeps of the first block are those of all SNPs.
+// With an LD cache (pb.ldcache), G has no columns and yhat stays 0, and the
+// LD matrices are decoded from the cache rather than kept in pb.ld; in single
+// precision (pb.fgenotypes), G has no columns either.
+
+template <class Model>
+void solvePath(ElnetProblem<Model>& pb, arma::mat& G, const arma::vec& lambda,
+               double shrink, bool keepld, double thr, int trace, int maxiter,
+               int nthreads, const ElnetControl& ctrl, bool sparse, bool keeppred,
+               std::vector<ElnetWorkspace>& ws, ElnetPath& path,
+               const std::atomic<bool>* abort)
+{
+  int i, j, k, t;
+  const Model& model = pb.model;
+  int nq = model.q();
+  int nsubjects = G.n_rows;
+  int len = pb.r.n_elem;
+  int lenall = pb.rall.n_elem;
+  int nsnps = lenall / nq;
+  int nblocks = pb.startvec.n_elem;
+
+  arma::mat genotypes_one_phenotype = G * sqrt(1.0 - shrink);
+
+  // Ensuite on construit la matrice pour plusieurs phénotypes, seulement si un
+  // bloc est résolu par repelnetCore (pas avec la matrice LD en bande, le cache
+  // LD ou la simple précision): les valeurs ajustées des blocs déjà résolus se
+  // calculent sur les génotypes d'un seul phénotype
+
+  bool band = (pb.window > 0);
+  bool expand = (!band && pb.ldcache == NULL && pb.fgenotypes == NULL &&
+                 std::find(pb.presolved.begin(), pb.presolved.end(), 0) != pb.presolved.end());
+  arma::mat genotypes;
+  if(expand) genotypes = GenotypeMatrixMultiplePhenotypes(genotypes_one_phenotype,nq);
+
+  ElnetCoreFn<Model> core = elnetCoreFor<Model>(nq);
+  arma::vec x = pb.x;
+  arma::vec xconstant = pb.xconstant;
+  arma::vec xall(lenall);
+
+  path.pred.zeros(keeppred ? nsubjects * nq : 0, lambda.n_elem);
+  path.out.set_size(lambda.n_elem);
+  path.loss.set_size(lambda.n_elem);
+  path.fbeta.set_size(lambda.n_elem);
+  // The SNPs of zero variance are not in G: diag(X'X) is 1 - shrink for all
+  arma::vec diag(len); diag.fill(1.0 - shrink);
+
+  arma::vec yhat(nsubjects * nq, arma::fill::zeros);
+  arma::vec Rx, bandd, bandb;
+  // yhat = genotypes * x;
+
+  // Number of sweeps, of accepted Anderson extrapolations and of betas screened out of
+  // each block and time taken for each lambda, to compare the schemes
+  path.sweeps.zeros(nblocks, lambda.n_elem);
+  path.extrapolations.zeros(nblocks, lambda.n_elem);
+  path.screened.zeros(nblocks, lambda.n_elem);
+  path.ldhits.zeros(nblocks, lambda.n_elem);
+  path.ldmisses.zeros(nblocks, lambda.n_elem);
+  path.time.set_size(lambda.n_elem);
+  arma::Mat<int> fistaconv(nblocks, lambda.n_elem, arma::fill::ones);
+
+  // With sparse, the betas are returned in compressed sparse column form, built
+  // one lambda at a time from the nonzero betas
+  path.beta.set_size(lenall, sparse ? 0 : lambda.n_elem);
+  path.betarows.clear();
+  path.betavalues.clear();
+  path.betacolptr.zeros(lambda.n_elem + 1);
+  path.nparams.zeros(lambda.n_elem);
+
+  // The factors of the low-rank blocks, scaled and expanded as genotypes
+  std::vector<arma::mat> lowrankX(nblocks);
+  std::vector<arma::vec> lowrankdiag(nblocks);
+  for(j=0; j < nblocks; j++) {
+    if(!pb.lowrank[j]) continue;
+    lowrankX[j] = GenotypeMatrixMultiplePhenotypes(pb.factor[j] * sqrt(1.0 - shrink), nq);
+    lowrankdiag[j].set_size(lowrankX[j].n_cols);
+    for(int c=0; c < lowrankX[j].n_cols; c++)
+      lowrankdiag[j](c) = arma::dot(lowrankX[j].col(c), lowrankX[j].col(c));
+  }
+
+  // The statistics of the blocks and the scratch space of the solvers,
+  // allocated once for the whole path
+  std::vector<ElnetStats> stats(nblocks);
+  std::vector<int> blockconv(nblocks, 1);
+  std::vector<ElnetStats> taskstats;
+  std::vector<int> taskconv;
+  arma::vec xkconstant(nq);
+  arma::mat quadyhat(nq, nsubjects);
+  arma::mat quadx1(nq, nsnps), quadx2(nq, nsnps);
+  double fistatime = 0.0;
+  arma::mat fistabeta(pb.anyfista ? len : 0, lambda.n_elem);
+  if(pb.anyfista) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    fistaBlocks(lambda, shrink, G, pb.r, model, x, ctrl.gaptol > 0 ? ctrl.gaptol : 1e-8,
+                maxiter, pb.startvec, pb.endvec, pb.fista, nthreads, trace-1, fistabeta,
+                path.sweeps, fistaconv, (keepld && pb.ldcache == NULL) ? &pb.ld : NULL,
+                pb.ldcache, abort);
+    fistatime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  // With the LD cache, the LD matrices are decoded from the cache when needed
+  // rather than kept: the quadratic term of loss in yhat is computed here from
+  // the betas for every lambda (see ldQuad), decoding the LD matrix of each
+  // block once. A block that FISTA did not solve cannot be solved without the
+  // genotypes.
+  arma::vec cachequad(pb.ldcache != NULL ? lambda.n_elem : 0, arma::fill::zeros);
+  if(pb.ldcache != NULL && !(abort != NULL && abort->load())) {
+    for(j=0; j < nblocks; j++) {
+      if(pb.endvec(j) < pb.startvec(j)) continue;
+      if(!pb.fista[j]) {
+        throw std::runtime_error("Block " + std::to_string(j + 1) + " cannot be solved by FISTA, "
+                                 "nor without the genotypes: run it without ldcache");
+      }
+      arma::mat R = pb.ldcache->ld(j);
+      int p = (pb.endvec(j) - pb.startvec(j) + 1) / nq;
+      for(i=0; i < lambda.n_elem; i++) {
+        arma::mat xb(fistabeta.colptr(i) + pb.startvec(j), nq, p, false, true);
+        cachequad(i) += (1.0 - shrink) * model.ldQuad(xb, R);
+      }
+    }
+  }
+
+  // Rcout << "Starting loop" << std::endl;
+  for (i = 0; i < lambda.n_elem; ++i) {
+    if (trace > 0)
+      Rcpp::Rcout << "lambda: " << lambda(i) << "\n" << std::endl;
+    std::fill(stats.begin(), stats.end(), ElnetStats());
+    for(j=0; j < nblocks; j++) {
+      if(pb.fista[j])
+        x.subvec(pb.startvec(j), pb.endvec(j)) = fistabeta.col(i).subvec(pb.startvec(j), pb.endvec(j));
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if(band) {
+      path.out(i) = bandCore(model, lambda(i), shrink, pb.band, 1.0 - shrink, pb.r, thr, x, Rx,
+                             bandd, bandb, pb.window, trace-1, maxiter, stats[0], abort);
+      path.time(i) = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      if(abort != NULL && abort->load()) return;
+      path.sweeps(0,i) = stats[0].sweeps;
+      // yhat = X*x, calculé sur les génotypes d'un seul phénotype, sans matrice
+      // temporaire
+      arma::mat xq(x.memptr(), nq, x.n_elem / nq, false, true);
+      arma::mat yhatq(yhat.memptr(), nq, nsubjects, false, true);
+      yhatq = xq * genotypes_one_phenotype.t();
+    } else if(pb.fgenotypes != NULL) {
+      floatBlocks(lambda(i), shrink, *pb.fgenotypes, pb.fdiag, pb.r, model, thr, x, trace-1,
+                  maxiter, pb.startvec, pb.endvec, pb.polish, nthreads, ws, stats, blockconv,
+                  abort);
+      path.time(i) = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      if(abort != NULL && abort->load()) return;
+      path.out(i) = 1;
+      for(j=0; j < nblocks; j++) {
+        path.out(i) = std::min(path.out(i), (double) blockconv[j]);
+        path.sweeps(j,i) = stats[j].sweeps;
+      }
+      // yhat = X*x, calculé en double précision sur les génotypes en simple précision
+      const arma::fmat& Gf = *pb.fgenotypes;
+      double scale = sqrt(1.0 - shrink);
+      yhat.zeros();
+      for(t=0; t < (int) Gf.n_cols; t++) {
+        const float* g = Gf.colptr(t);
+        for(k=0; k < nq; k++) {
+          double a = scale * x(nq*t+k);
+          if(a == 0.0) continue;
+          for(int s=0; s < nsubjects; s++) yhat(nq*s+k) += a * g[s];
+        }
+      }
+    } else if(pb.ldcache != NULL) {
+      path.out(i) = 1;
+      path.time(i) = fistatime / lambda.n_elem;
+      for(j=0; j < nblocks; j++) {
+        if(pb.fista[j]) path.out(i) = std::min(path.out(i), (double) fistaconv(j,i));
+      }
+    } else {
+      traitBlocks(lambda(i), shrink, genotypes_one_phenotype, diag, pb.r, model, thr, x,
+                  trace-1, maxiter, pb.startvec, pb.endvec, pb.bytrait, nthreads, ctrl, ws,
+                  stats, blockconv, taskstats, taskconv, abort);
+      lowrankBlocks(lambda(i), shrink, lowrankX, lowrankdiag, pb.r, model, core, thr, x, trace-1,
+                    maxiter, pb.startvec, pb.endvec, pb.lowrank, nthreads, ctrl, ws, stats,
+                    blockconv, abort);
+      ldColumnsBlocks(lambda(i), shrink, pb.columns, pb.r, model, thr, x, trace-1, maxiter,
+                      pb.startvec, pb.endvec, pb.lazy, nthreads, ws, stats, blockconv, abort);
+      shotgunBlocks(lambda(i), shrink, G, pb.plans, pb.r, model, thr, x, trace-1, maxiter,
+                    pb.startvec, pb.endvec, pb.shotgun, nthreads, ws, stats, blockconv, abort);
+      if(expand) {
+        // repelnetCore ajoute les valeurs ajustées de chaque bloc à yhat: on repart
+        // de 0 pour chaque lambda, afin que yhat = X*x
+        yhat.zeros();
+        path.out(i) =
+          repelnetCore(model, lambda(i), shrink, diag,genotypes, pb.r, thr, x, yhat, trace-1, maxiter,
+                       pb.startvec, pb.endvec, nthreads, core, ctrl, ws, stats, pb.presolved, abort);
+      } else {
+        // Tous les blocs sont déjà résolus: yhat = X*x, calculé sur les génotypes
+        // d'un seul phénotype, sans matrice temporaire
+        path.out(i) = 1;
+        arma::mat xq(x.memptr(), nq, x.n_elem / nq, false, true);
+        arma::mat yhatq(yhat.memptr(), nq, nsubjects, false, true);
+        yhatq = xq * genotypes_one_phenotype.t();
+      }
+      path.time(i) = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() +
+        fistatime / lambda.n_elem;
+      if(abort != NULL && abort->load()) return;
+      for(j=0; j < nblocks; j++) {
+        if(pb.fista[j]) path.out(i) = std::min(path.out(i), (double) fistaconv(j,i));
+        else path.sweeps(j,i) = stats[j].sweeps;
+        if(pb.bytrait[j] || pb.lowrank[j] || pb.lazy[j] || pb.shotgun[j])
+          path.out(i) = std::min(path.out(i), (double) blockconv[j]);
+        path.extrapolations(j,i) = stats[j].extrapolations;
+        path.screened(j,i) = stats[j].screened;
+        path.ldhits(j,i) = stats[j].ldhits;
+        path.ldmisses(j,i) = stats[j].ldmisses;
+      }
+    }
+
+    // The betas of every SNP: those of the SNPs kept, those of the SNPs of zero
+    // variance, solved on their own (see constantSnpCore, whose convergence counts
+    // in path.out), and zero for the others
+    xall.zeros();
+    for(t=0; t < pb.kept.n_elem; t++) {
+      for(k=0; k < nq; k++) xall(nq*pb.kept(t)+k) = x(nq*t+k);
+    }
+    for(t=0; t < pb.constant.n_elem; t++) {
+      int conv = constantSnpCore(model, lambda(i), shrink, pb.rall.memptr() + nq*pb.constant(t),
+                                 xconstant.memptr() + nq*t, xkconstant.memptr(), thr, maxiter);
+      path.out(i) = std::min(path.out(i), (double) conv);
+      for(k=0; k < nq; k++) xall(nq*pb.constant(t)+k) = xconstant(nq*t+k);
+    }
+    if(i == 0) {
+      pb.x = x;
+      pb.xconstant = xconstant;
+    }
+
+    for(j=0; j < lenall; j++) {
+      double v = xall(j);
+      if(pb.sd_MultiplePheno(j) == 0.0) v = v * shrink;
+      if(v != 0.0) path.nparams(i)++;
+      if(!sparse) {
+        path.beta(j,i) = v;
+      } else if(v != 0.0) {
+        path.betarows.push_back(j);
+        path.betavalues.push_back(v);
+      }
+    }
+    path.betacolptr(i+1) = path.betavalues.size();
+
+    if (path.out(i) != 1) {
+      throw std::runtime_error("Not converging.....");
+    }
+
+    if(keeppred) path.pred.col(i) = yhat;
+
+    // Loss and fbeta, their quadratic forms applied by the model through the
+    // q x n and q x p views of yhat and the betas
+
+    arma::mat xq(xall.memptr(), nq, nsnps, false, true);
+    double quad = (pb.ldcache == NULL) ? model.fittedQuad(yhat.memptr(), nsubjects, quadyhat)
+                                       : cachequad(i);
+    path.loss(i) = quad - 2.0 * arma::accu(xq % pb.lossweights);
+    path.fbeta(i) = path.loss(i) + 2.0 * arma::accu(arma::abs(xall)) * lambda(i) +
+      model.betaQuad(xq, shrink, quadx1, quadx2);
+  }
+}
+
+// The results of solvePath as an R list. The sds are those of every
+// coefficient, returned as such or, if Model::snpSd, as those of every SNP.
+template <class Model>
+Rcpp::List pathList(const arma::vec& sd_MultiplePheno, int nq, const ElnetPath& path,
+                    const arma::vec& lambda, double shrink, bool sparse)
+{
+  arma::sp_mat spbeta;
+  if(sparse) {
+    arma::uvec rowind(path.betarows.size());
+    arma::vec values(path.betavalues.size());
+    std::copy(path.betarows.begin(), path.betarows.end(), rowind.begin());
+    std::copy(path.betavalues.begin(), path.betavalues.end(), values.begin());
+    spbeta = arma::sp_mat(rowind, path.betacolptr, values, sd_MultiplePheno.n_elem,
+                          lambda.n_elem);
+  }
+
+  // Les sd d'un SNP sont répétés pour ses nq coefficients
+  arma::vec sd = sd_MultiplePheno;
+  if(Model::snpSd) {
+    sd.set_size(sd_MultiplePheno.n_elem / nq);
+    for(arma::uword j=0; j < sd.n_elem; j++) sd(j) = sd_MultiplePheno(nq*j);
+  }
+
+  return Rcpp::List::create(Rcpp::Named("lambda") = lambda,
+                            Rcpp::Named("shrink") = shrink,
+                            Rcpp::Named("beta") = sparse ? Rcpp::wrap(spbeta) : Rcpp::wrap(path.beta),
+                            Rcpp::Named("conv") = path.out,
+                            Rcpp::Named("pred") = path.pred,
+                            Rcpp::Named("loss") = path.loss,
+                            Rcpp::Named("fbeta") = path.fbeta,
+                            Rcpp::Named("nparams") = path.nparams,
+                            Rcpp::Named(Model::snpSd ? "sd" : "sd_MultiplePheno") = sd,
+                            Rcpp::Named("sweeps") = path.sweeps,
+                            Rcpp::Named("extrapolations") = path.extrapolations,
+                            Rcpp::Named("screened") = path.screened,
+                            Rcpp::Named("ldhits") = path.ldhits,
+                            Rcpp::Named("ldmisses") = path.ldmisses,
+                            Rcpp::Named("time") = path.time);
+}
+
+// The standardized genotypes of consecutive SNPs read on their own (see
+// readSnps), with the filter of these SNPs
+struct SnpRange {
+  arma::mat G;
+  SnpFilter filter;
+};
+
+// The column of the .bed file of each SNP selected by col_skip_pos and col_skip
+inline std::vector<int> selectedColumns(int P, const arma::Col<int>& col_skip_pos,
+                                        const arma::Col<int>& col_skip)
+{
+  std::vector<int> columns;
+  int i = 0, t = 0;
+  while(i < P) {
+    if(t < (int) col_skip_pos.n_elem && i == col_skip_pos(t)) {
+      i += col_skip(t++);
+      continue;
+    }
+    columns.push_back(i++);
+  }
+  return columns;
+}
+
+// Reads and standardizes the selected SNPs j0 to j1 (columns as returned by
+// selectedColumns), skipping all the other columns of the file. abort is as
+// in readGenotypes.
+inline SnpRange readSnps(const std::string& fileName, int N, int P,
+                         const std::vector<int>& columns, int j0, int j1,
+                         const arma::Col<int>& keepbytes, const arma::Col<int>& keepoffset,
+                         double maf, double callrate, const std::atomic<bool>* abort)
+{
+  SnpRange snps;
+  snps.filter = SnpFilter(maf, callrate);
+  std::vector<int> pos, skip;
+  int at = 0;
+  for(int j=j0; j <= j1; j++) {
+    if(columns[j] > at) {
+      pos.push_back(at);
+      skip.push_back(columns[j] - at);
+    }
+    at = columns[j] + 1;
+  }
+  if(at < P) {
+    pos.push_back(at);
+    skip.push_back(P - at);
+  }
+  arma::Col<int> skippos(pos.size()), skiplen(skip.size());
+  std::copy(pos.begin(), pos.end(), skippos.begin());
+  std::copy(skip.begin(), skip.end(), skiplen.begin());
+  snps.G = readGenotypes(fileName, N, P, skippos, skiplen, keepbytes, keepoffset, 1,
+                         &snps.filter, abort);
+  normalizeColumns(snps.G);
+  return snps;
+}
+
+// Reads the next block of streamElnet on a thread of its own while the current
+// one is solved. The thread is told to stop, and joined, when the prefetch goes
+// out of scope, so that an interrupt of the solver does not leave it running.
+class SnpPrefetch {
+public:
+  SnpPrefetch() : abort(false) {}
+
+  ~SnpPrefetch() {
+    abort = true;
+    if(thread.joinable()) thread.join();
+  }
+
+  template <class Read>
+  void start(Read read) {
+    thread = std::thread([this, read]() {
+      try {
+        snps = read(&abort);
+      } catch(...) {
+        error = std::current_exception();
+      }
+    });
+  }
+
+  SnpRange get() {
+    thread.join();
+    if(error) std::rethrow_exception(error);
+    return std::move(snps);
+  }
+
+private:
+  std::atomic<bool> abort;
+  std::thread thread;
+  SnpRange snps;
+  std::exception_ptr error;
+};
+
+// Checks that the blocks are made of whole SNPs and cover the lenall
+// coefficients in order, as streamElnet and runElnetChunksCore require
+inline void checkBlockTiling(const arma::Col<int>& startvec, const arma::Col<int>& endvec,
+                             int nq, int lenall)
+{
+  int nblocks = startvec.n_elem;
+  bool tiled = (nblocks > 0 && endvec(nblocks-1) == lenall - 1);
+  for(int b=0; b < nblocks && tiled; b++) {
+    tiled = (startvec(b) == (b == 0 ? 0 : endvec(b-1) + 1) && startvec(b) % nq == 0 &&
+             (endvec(b) + 1) % nq == 0);
+  }
+  if(!tiled)
+    throw std::runtime_error("The blocks must be made of whole SNPs and cover all the SNPs "
+                               "in order");
+}
+
+// The problem of runElnet restricted to the blocks b0 to b1, on the genotypes
+// of their SNPs read by readSnps, with the options of runElnet for the blocks
+template <class Model>
+ElnetProblem<Model> blockRangeProblem(const Model& model, const arma::mat& cor,
+                                      const arma::mat& init, SnpRange& snps,
+                                      const arma::Col<int>& startvec, const arma::Col<int>& endvec,
+                                      int b0, int b1, const ElnetOptions& opt, double ldmemory,
+                                      int nthreads)
+{
+  int nq = model.q();
+  int j0 = startvec(b0) / nq;
+  int j1 = (endvec(b1) + 1) / nq - 1;
+  arma::Col<int> sv(b1 - b0 + 1), ev(b1 - b0 + 1);
+  for(int b=b0; b <= b1; b++) {
+    sv(b - b0) = startvec(b) - nq * j0;
+    ev(b - b0) = endvec(b) - nq * j0;
+  }
+  ElnetProblem<Model> pb = elnetProblem(model, cor.cols(j0, j1), init.cols(j0, j1),
+                                        snps.filter, sv, ev, opt.engine, opt.fistasize,
+                                        snps.G.n_rows, ldmemory / std::max(nthreads, 1));
+  shotgunProblem(pb, snps.G, opt.shotgun, opt.shotgunwindow, opt.shotgunthr, nthreads);
+  lowrankFactors(pb, snps.G, opt.lowrank, nthreads);
+  if(opt.engine == 3) ldColumnsProblem(pb, snps.G, ldmemory);
+  return pb;
+}
+
+// The paths of runElnet over all the SNPs, merged from those of groups of
+// consecutive blocks solved as problems of their own (see blockRangeProblem).
+// pred is the sum of the fitted values of the groups, and loss and fbeta are
+// those of the merged betas: the quadratic form of loss in pred is computed
+// on the merged pred, its other terms are summed over the groups.
+template <class Model>
+class MergedPaths {
+public:
+  MergedPaths(const Model& model, int nshrinks, int nblocks, int nl, int nrows, int lenall,
+              bool sparse) :
+    model(model), sparse(sparse), paths(nshrinks), lossrest(nshrinks), fbetarest(nshrinks),
+    betacols(nshrinks), sd(lenall, arma::fill::zeros),
+    quadyhat(model.q(), nrows / model.q()) {
+    for(int m=0; m < nshrinks; m++) {
+      ElnetPath& path = paths[m];
+      path.out.ones(nl);
+      path.pred.zeros(nrows, nl);
+      path.loss.set_size(nl);
+      path.fbeta.set_size(nl);
+      path.beta.zeros(lenall, sparse ? 0 : nl);
+      path.betacolptr.zeros(nl + 1);
+      path.nparams.zeros(nl);
+      path.sweeps.zeros(nblocks, nl);
+      path.extrapolations.zeros(nblocks, nl);
+      path.screened.zeros(nblocks, nl);
+      path.ldhits.zeros(nblocks, nl);
+      path.ldmisses.zeros(nblocks, nl);
+      path.time.zeros(nl);
+      lossrest[m].zeros(nl);
+      fbetarest[m].zeros(nl);
+    }
+  }
+
+  // Adds the path of shrink m of the group of blocks from block b0, whose SNPs
+  // start at SNP j0, solved with sparse betas and pred; sdgroup are the sds of
+  // the problem of the group
+  void add(int m, const ElnetPath& group, const arma::vec& sdgroup, int b0, int j0) {
+    int nq = model.q();
+    int nsubjects = group.pred.n_rows / nq;
+    ElnetPath& path = paths[m];
+    sd.subvec(nq * j0, nq * j0 + sdgroup.n_elem - 1) = sdgroup;
+    for(int i=0; i < (int) path.loss.n_elem; i++) {
+      path.time(i) += group.time(i);
+      path.nparams(i) += group.nparams(i);
+      for(int b=0; b < (int) group.sweeps.n_rows; b++) {
+        path.sweeps(b0+b,i) = group.sweeps(b,i);
+        path.extrapolations(b0+b,i) = group.extrapolations(b,i);
+        path.screened(b0+b,i) = group.screened(b,i);
+        path.ldhits(b0+b,i) = group.ldhits(b,i);
+        path.ldmisses(b0+b,i) = group.ldmisses(b,i);
+      }
+      path.pred.col(i) += group.pred.col(i);
+
+      lossrest[m](i) += group.loss(i) - model.fittedQuad(group.pred.colptr(i), nsubjects,
+                                                         quadyhat);
+      fbetarest[m](i) += group.fbeta(i) - group.loss(i);
+
+      // Les betas du groupe sont à la ligne nq*j0 de ceux de tous les SNPs
+      for(arma::uword s=group.betacolptr(i); s < group.betacolptr(i+1); s++) {
+        arma::uword row = nq * j0 + group.betarows[s];
+        if(!sparse) {
+          path.beta(row,i) = group.betavalues[s];
+        } else {
+          path.betarows.push_back(row);
+          path.betavalues.push_back(group.betavalues[s]);
+          betacols[m].push_back(i);
+        }
+      }
+    }
+  }
+
+  // The results of each shrink as an R list, once the groups have been added
+  // in the order of their SNPs
+  Rcpp::List results(const arma::vec& lambda, const arma::vec& shrinks, bool keeppred) {
+    int nq = model.q();
+    int nl = lambda.n_elem;
+    Rcpp::List out(shrinks.n_elem);
+    for(int m=0; m < (int) shrinks.n_elem; m++) {
+      ElnetPath& path = paths[m];
+      int nsubjects = path.pred.n_rows / nq;
+      for(int i=0; i < nl; i++) {
+        path.loss(i) = model.fittedQuad(path.pred.colptr(i), nsubjects, quadyhat) +
+          lossrest[m](i);
+        path.fbeta(i) = path.loss(i) + fbetarest[m](i);
+      }
+
+      // Les betas des groupes, rangés lambda par lambda
+      if(sparse) {
+        std::vector<size_t> order(betacols[m].size());
+        for(size_t s=0; s < order.size(); s++) order[s] = s;
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t c) {
+          return betacols[m][a] < betacols[m][c];
+        });
+        std::vector<arma::uword> rows(order.size());
+        std::vector<double> values(order.size());
+        for(size_t s=0; s < order.size(); s++) {
+          rows[s] = path.betarows[order[s]];
+          values[s] = path.betavalues[order[s]];
+          path.betacolptr(betacols[m][order[s]] + 1)++;
+        }
+        for(int i=0; i < nl; i++) path.betacolptr(i+1) += path.betacolptr(i);
+        path.betarows.swap(rows);
+        path.betavalues.swap(values);
+      }
+
+      if(!keeppred) path.pred.set_size(0, nl);
+      out[m] = pathList<Model>(sd, nq, path, lambda, shrinks(m), sparse);
+    }
+    return out;
+  }
+
+private:
+  Model model;
+  bool sparse;
+  std::vector<ElnetPath> paths;
+  std::vector<arma::vec> lossrest, fbetarest;
+  std::vector<std::vector<arma::uword> > betacols;  // the lambda of each of betarows
+  arma::vec sd;
+  arma::mat quadyhat;  // the scratch space of fittedQuad
+};
+
+// runElnet with stream: the blocks are read, standardized and solved one after
+// the other, the whole path of every shrink for each block, while the next
+// block is read on another thread. Only the genotypes of two blocks are then
+// in memory at once. The blocks must be made of whole SNPs and cover all the
+// SNPs in order; their paths are merged by MergedPaths.
+
+template <class Model>
+Rcpp::List streamElnet(const Model& model, const arma::vec& lambda, const arma::vec& shrinks,
+                       const std::string& fileName, const arma::mat& cor, int N, int P,
+                       const arma::Col<int>& col_skip_pos, const arma::Col<int>& col_skip,
+                       const arma::Col<int>& keepbytes, const arma::Col<int>& keepoffset,
+                       double thr, const arma::mat& init, int trace, int maxiter,
+                       const arma::Col<int>& startvec, const arma::Col<int>& endvec,
+                       const ElnetOptions& opt)
+{
+  int nq = model.q();
+  int nblocks = startvec.n_elem;
+  int nsubjects = (keepbytes.n_elem > 0) ? keepbytes.n_elem : N;
+  checkBlockTiling(startvec, endvec, nq, nq * cor.n_cols);
+  std::vector<int> columns = selectedColumns(P, col_skip_pos, col_skip);
+  if((int) columns.size() != (int) cor.n_cols)
+    throw std::runtime_error("Number of positions in reference file is not "
+                               "equal the number of regression coefficients");
+
+  auto read = [&](int b, const std::atomic<bool>* abort) {
+    return readSnps(fileName, N, P, columns, startvec(b) / nq, (endvec(b) + 1) / nq - 1,
+                    keepbytes, keepoffset, opt.maf, opt.callrate, abort);
+  };
+
+  // The workspaces, sized for the largest block, serve every block
+  std::vector<ElnetWorkspace> ws = elnetWorkspaces(startvec, endvec, nsubjects * nq,
+                                                   opt.nthreads, opt.anderson);
+  MergedPaths<Model> merged(model, shrinks.n_elem, nblocks, lambda.n_elem, nsubjects * nq,
+                            nq * cor.n_cols, opt.sparse);
+
+  // The first block is read here, on the main thread, which prints the warnings
+  // of openPlinkBinaryFile; the prefetches open the file quietly
+  SnpRange current = read(0, NULL);
+  for(int b=0; b < nblocks; b++) {
+    SnpPrefetch next;
+    if(b + 1 < nblocks) next.start([&read, b](const std::atomic<bool>* abort) {
+      return read(b + 1, abort);
+    });
+    if (trace > 0)
+      Rcpp::Rcout << "block: " << b << "\n" << std::endl;
+
+    if(endvec(b) >= startvec(b)) {
+      ElnetProblem<Model> pb = blockRangeProblem(model, cor, init, current, startvec, endvec,
+                                                 b, b, opt, opt.ldmemory, opt.nthreads);
+      for(int m=0; m < shrinks.n_elem; m++) {
+        ElnetPath path;
+        solvePath(pb, current.G, lambda, shrinks(m), shrinks.n_elem > 1, thr, trace, maxiter,
+                  opt.nthreads, opt.control(), true, true, ws, path, NULL);
+        merged.add(m, path, pb.sd_MultiplePheno, b, startvec(b) / nq);
+      }
+    }
+
+    if(b + 1 < nblocks) current = next.get();
+  }
+  return merged.results(lambda, shrinks, opt.keeppred);
+}
+
+// The body of runElnet, for the model of its traits
+template <class Model>
+Rcpp::List runElnetCore(const Model& model, const arma::vec& lambda, const arma::vec& shrinks,
+                        const std::string& fileName, const arma::mat& cor, int N, int P,
+                        const arma::Col<int>& col_skip_pos, const arma::Col<int>& col_skip,
+                        const arma::Col<int>& keepbytes, const arma::Col<int>& keepoffset,
+                        double thr, const arma::mat& init, int trace, int maxiter,
+                        const arma::Col<int>& startvec, const arma::Col<int>& endvec,
+                        ElnetOptions opt, bool stream)
+{
+  // a) read bed file
+  // b) standardize genotype matrix
+  // c) for each shrink, multiply by constatant factor
+  // d) perfrom elnet
+
+  checkConvexity(model, opt);
+  if(stream)
+    return streamElnet(model, lambda, shrinks, fileName, cor, N, P, col_skip_pos, col_skip,
+                       keepbytes, keepoffset, thr, init, trace, maxiter, startvec, endvec, opt);
+
+  // With a cache of the LD of the blocks for this run, the genotypes are not read
+  int nq = model.q();
+  int nthreads = opt.nthreads;
+  LdCache cache;
+  uint64_t key = 0;
+  bool usecache = (!opt.ldcache.empty() && !opt.single && opt.lowrank <= 0.0 &&
+                   opt.windowend.n_elem == 0 &&
+                   ldCacheKey(fileName, N, P, col_skip_pos, col_skip, keepbytes, keepoffset,
+                              opt.maf, opt.callrate, startvec, endvec, nq, key));
+  // The blocks of a cache are solved by FISTA: it is not used, before anything
+  // is read or written, if a block would not be left to FISTA by engine 2
+  // whatever its size (see fistaAffordable), counting all of its SNPs
+  int nsubjects = (keepbytes.n_elem > 0) ? keepbytes.n_elem : N;
+  for(int j=0; usecache && j < startvec.n_elem; j++) {
+    double p = (endvec(j) - startvec(j) + 1) / nq;
+    if(!fistaAffordable(p, nsubjects, opt.ldmemory / std::max(nthreads, 1))) {
+      Rcpp::Rcerr << "Warning, block " << j + 1 << " is too large for FISTA: the LD cache "
+                  << opt.ldcache << " is not used" << std::endl;
+      usecache = false;
+    }
+  }
+  bool cached = usecache && cache.open(opt.ldcache, key);
+
+  // Only the SNPs which vary, and pass the maf and callrate filters, are read
+  // (see SnpFilter)
+  SnpFilter filter(opt.maf, opt.callrate);
+  arma::mat genotypes_standardized;
+  arma::fmat fgenotypes;
+  arma::vec means;
+  if(opt.single) {
+    fgenotypes = readGenotypes<float>(fileName, N, P, col_skip_pos, col_skip, keepbytes,
+                                      keepoffset, 1, &filter);
+    normalizeColumns(fgenotypes);
+    genotypes_standardized.set_size(fgenotypes.n_rows, 0);
+  } else if(cached) {
+    filter.kept = cache.kept();
+    filter.constant = cache.constant();
+    filter.sd = cache.sd();
+    genotypes_standardized.set_size(cache.nsubjects(), 0);
+    opt.keeppred = false;
+  } else {
+    genotypes_standardized = readGenotypes(fileName, N, P, col_skip_pos, col_skip, keepbytes,
+                                           keepoffset, 1, &filter);
+    if(usecache) {
+      means.set_size(genotypes_standardized.n_cols);
+      for(int j=0; j < means.n_elem; j++) means(j) = arma::mean(genotypes_standardized.col(j));
+    }
+
+    // On commence par normaliser la matrice génotype pour un seul phénotype
+    // (les sd de tous les SNPs sont dans filter)
+
+    normalizeColumns(genotypes_standardized);
+  }
+
+  ElnetProblem<Model> pb = elnetProblem(model, cor, init, filter, startvec, endvec, opt.engine,
+                                        opt.fistasize, genotypes_standardized.n_rows,
+                                        opt.ldmemory / std::max(nthreads, 1));
+  if(opt.single) {
+    singleProblem(pb, fgenotypes, opt.polish);
+  } else if(cached) {
+    ldCacheProblem(pb, cache, opt.ldmemory / std::max(nthreads, 1));
+  } else {
+    if(usecache)
+      writeProblemLdCache(opt.ldcache, key, opt.ldprecision, pb, filter, genotypes_standardized,
+                          means);
+    shotgunProblem(pb, genotypes_standardized, opt.shotgun, opt.shotgunwindow, opt.shotgunthr,
+                   nthreads);
+    lowrankFactors(pb, genotypes_standardized, opt.lowrank, nthreads);
+    if(opt.engine == 3) ldColumnsProblem(pb, genotypes_standardized, opt.ldmemory);
+    bandProblem(pb, genotypes_standardized, opt.windowend, opt.ldthr, nthreads);
+  }
+
+  // The workspaces are allocated once for all shrinks and lambdas
+  std::vector<ElnetWorkspace> ws=elnetWorkspaces(pb.startvec, pb.endvec,
+                                                 genotypes_standardized.n_rows * nq,
+                                                 nthreads, opt.anderson);
+
+  // The shrinks are solved one after the other on the same standardized genotypes,
+  // which each only rescales. The path of a shrink starts from the solution of the
+  // previous shrink for the first lambda, its nearest point on the grid.
+  Rcpp::List results(shrinks.n_elem);
+  for (int m = 0; m < shrinks.n_elem; ++m) {
+    if (trace > 0)
+      Rcpp::Rcout << "shrink: " << shrinks(m) << "\n" << std::endl;
+    ElnetPath path;
+    solvePath(pb, genotypes_standardized, lambda, shrinks(m), shrinks.n_elem > 1, thr, trace,
+              maxiter, nthreads, opt.control(), opt.sparse, opt.keeppred, ws, path, NULL);
+    results[m] = pathList<Model>(pb.sd_MultiplePheno, nq, path, lambda, shrinks(m), opt.sparse);
+  }
+
+  return results;
+}
+
+// The body of runElnetBatch: problem t is that of models[t], its correlations
+// cor[t], initial betas init[t] and blocks startvec[t], endvec[t]. The LD cache
+// and single precision are not used.
+template <class Model>
+Rcpp::List runElnetBatchCore(const std::vector<Model>& models, const arma::vec& lambda,
+                             const arma::vec& shrinks, const std::string& fileName,
+                             Rcpp::List cor, int N, int P,
+                             const arma::Col<int>& col_skip_pos, const arma::Col<int>& col_skip,
+                             const arma::Col<int>& keepbytes, const arma::Col<int>& keepoffset,
+                             double thr, Rcpp::List init, int trace, int maxiter,
+                             Rcpp::List startvec, Rcpp::List endvec, const ElnetOptions& opt)
+{
+  int nthreads = opt.nthreads;
+  for(size_t t=0; t < models.size(); t++) checkConvexity(models[t], opt);
+
+  SnpFilter filter(opt.maf, opt.callrate);
+  arma::mat genotypes_standardized = readGenotypes(fileName, N, P, col_skip_pos, col_skip, keepbytes,
+                                                   keepoffset, 1, &filter);
+  normalizeColumns(genotypes_standardized);
+  int nproblems = cor.size();
+  int nsubjects = genotypes_standardized.n_rows;
+
+  std::vector<ElnetProblem<Model> > pb;
+  for(int t=0; t < nproblems; t++) {
+    pb.push_back(elnetProblem(models[t], Rcpp::as<arma::mat>(cor[t]),
+                              Rcpp::as<arma::mat>(init[t]), filter,
+                              Rcpp::as<arma::Col<int> >(startvec[t]),
+                              Rcpp::as<arma::Col<int> >(endvec[t]), opt.engine, opt.fistasize,
+                              nsubjects, opt.ldmemory / std::max(nthreads, 1)));
+    shotgunProblem(pb[t], genotypes_standardized, opt.shotgun, opt.shotgunwindow,
+                   opt.shotgunthr, nthreads);
+    lowrankFactors(pb[t], genotypes_standardized, opt.lowrank, nthreads);
+    if(opt.engine == 3) ldColumnsProblem(pb[t], genotypes_standardized, opt.ldmemory / nproblems);
+    bandProblem(pb[t], genotypes_standardized, opt.windowend, opt.ldthr, nthreads);
+  }
+  ElnetControl ctrl = opt.control();
+  std::vector<std::vector<ElnetPath> > paths(nproblems, std::vector<ElnetPath>(shrinks.n_elem));
+
+  // Problem t, for every shrink, its blocks being solved on blockthreads threads
+  auto solve = [&](int t, int blockthreads, int trace, const std::atomic<bool>* abort) {
+    std::vector<ElnetWorkspace> ws=elnetWorkspaces(pb[t].startvec, pb[t].endvec,
+                                                   nsubjects * pb[t].model.q(),
+                                                   blockthreads, opt.anderson);
+    for(int m=0; m < shrinks.n_elem; m++) {
+      if(abort == NULL && trace > 0)
+        Rcpp::Rcout << "Problem: " << t << ", shrink: " << shrinks(m) << "\n" << std::endl;
+      solvePath(pb[t], genotypes_standardized, lambda, shrinks(m), shrinks.n_elem > 1, thr,
+                trace, maxiter, blockthreads, ctrl, opt.sparse, opt.keeppred, ws, paths[t][m],
+                abort);
+      if(abort != NULL && abort->load()) return;
+    }
+  };
+
+  if(nthreads > 1 && nproblems > 1) {
+    // The largest problems are handed out first (see blocksLargestFirst)
+    std::vector<int> order(nproblems);
+    for(int t=0; t < nproblems; t++) order[t] = t;
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+      return pb[a].r.n_elem > pb[b].r.n_elem;
+    });
+    // runBlocks would report problems rather than blocks: no trace here
+    runBlocks(nproblems, order, std::min(nthreads, nproblems), 0,
+              [&](int t, int thread, const std::atomic<bool>& abort) {
+      solve(t, 1, 0, &abort);
+    });
+  } else {
+    for(int t=0; t < nproblems; t++) solve(t, nthreads, trace, NULL);
+  }
+
+  Rcpp::List results(nproblems);
+  for(int t=0; t < nproblems; t++) {
+    Rcpp::List shrinkresults(shrinks.n_elem);
+    for(int m=0; m < shrinks.n_elem; m++)
+      shrinkresults[m] = pathList<Model>(pb[t].sd_MultiplePheno, pb[t].model.q(), paths[t][m],
+                                         lambda, shrinks(m), opt.sparse);
+    results[t] = shrinkresults;
+  }
+  return results;
+}
+
+// The body of runElnetChunks, for the model of its traits: the blocks of
+// chunk c are those b for which chunks(b) is c. The LD cache, single
+// precision and the banded LD matrix are not used.
+template <class Model>
+Rcpp::List runElnetChunksCore(const Model& model, const arma::vec& lambda,
+                              const arma::vec& shrinks, const std::string& fileName,
+                              const arma::mat& cor, int N, int P,
+                              const arma::Col<int>& col_skip_pos, const arma::Col<int>& col_skip,
+                              const arma::Col<int>& keepbytes, const arma::Col<int>& keepoffset,
+                              double thr, const arma::mat& init, int trace, int maxiter,
+                              const arma::Col<int>& startvec, const arma::Col<int>& endvec,
+                              const arma::Col<int>& chunks, const ElnetOptions& opt)
+{
+  int nq = model.q();
+  int nthreads = opt.nthreads;
+  int nblocks = startvec.n_elem;
+  int nsubjects = (keepbytes.n_elem > 0) ? keepbytes.n_elem : N;
+  checkConvexity(model, opt);
+  checkBlockTiling(startvec, endvec, nq, nq * cor.n_cols);
+  std::vector<int> columns = selectedColumns(P, col_skip_pos, col_skip);
+  if((int) columns.size() != (int) cor.n_cols)
+    throw std::runtime_error("Number of positions in reference file is not "
+                               "equal the number of regression coefficients");
+  if((int) chunks.n_elem != nblocks)
+    throw std::runtime_error("chunks must give the chunk of each block");
+
+  // Les blocs du chunk c vont de first[c] à first[c+1] - 1
+  std::vector<int> first(1, 0);
+  for(int b=1; b < nblocks; b++) {
+    if(chunks(b) < chunks(b-1))
+      throw std::runtime_error("The chunks must be in increasing order");
+    if(chunks(b) != chunks(b-1)) first.push_back(b);
+  }
+  first.push_back(nblocks);
+  int nchunks = first.size() - 1;
+  int nworkers = std::max(1, std::min(nthreads, nchunks));
+
+  ElnetControl ctrl = opt.control();
+  std::vector<std::vector<ElnetPath> > paths(nchunks, std::vector<ElnetPath>(shrinks.n_elem));
+  std::vector<arma::vec> sds(nchunks);
+
+  // Chunk c, for every shrink, its blocks being solved on blockthreads threads
+  auto solve = [&](int c, int blockthreads, int trace, const std::atomic<bool>* abort) {
+    int b0 = first[c], b1 = first[c+1] - 1;
+    int j0 = startvec(b0) / nq, j1 = (endvec(b1) + 1) / nq - 1;
+    if(j1 < j0) return;
+    SnpRange snps = readSnps(fileName, N, P, columns, j0, j1, keepbytes, keepoffset, opt.maf,
+                             opt.callrate, abort);
+    if(abort != NULL && abort->load()) return;
+    ElnetProblem<Model> pb = blockRangeProblem(model, cor, init, snps, startvec, endvec, b0, b1,
+                                               opt, opt.ldmemory / nworkers, blockthreads);
+    std::vector<ElnetWorkspace> ws=elnetWorkspaces(pb.startvec, pb.endvec, nsubjects * nq,
+                                                   blockthreads, opt.anderson);
+    sds[c] = pb.sd_MultiplePheno;
+    for(int m=0; m < shrinks.n_elem; m++) {
+      if(abort == NULL && trace > 0)
+        Rcpp::Rcout << "Chunk: " << c << ", shrink: " << shrinks(m) << "\n" << std::endl;
+      solvePath(pb, snps.G, lambda, shrinks(m), shrinks.n_elem > 1, thr, trace, maxiter,
+                blockthreads, ctrl, true, true, ws, paths[c][m], abort);
+      if(abort != NULL && abort->load()) return;
+    }
+  };
+
+  if(nworkers > 1) {
+    // The workers open the file quietly (see readGenotypes): it is opened once
+    // here first, so that its warnings are printed from the main thread
+    std::ifstream bedFile;
+    openPlinkBinaryFile(fileName, bedFile);
+    bedFile.close();
+
+    // The largest chunks are handed out first (see blocksLargestFirst)
+    std::vector<int> order(nchunks);
+    for(int c=0; c < nchunks; c++) order[c] = c;
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+      return endvec(first[a+1]-1) - startvec(first[a]) > endvec(first[b+1]-1) - startvec(first[b]);
+    });
+    // runBlocks would report chunks rather than blocks: no trace here
+    runBlocks(nchunks, order, nworkers, 0,
+              [&](int c, int thread, const std::atomic<bool>& abort) {
+      solve(c, 1, 0, &abort);
+    });
+  } else {
+    for(int c=0; c < nchunks; c++) solve(c, nthreads, trace, NULL);
+  }
+
+  // Les chunks sont fusionnés dans l'ordre de leurs SNPs
+  MergedPaths<Model> merged(model, shrinks.n_elem, nblocks, lambda.n_elem, nsubjects * nq,
+                            nq * cor.n_cols, opt.sparse);
+  for(int c=0; c < nchunks; c++) {
+    if(sds[c].n_elem == 0) continue;
+    for(int m=0; m < shrinks.n_elem; m++)
+      merged.add(m, paths[c][m], sds[c], first[c], startvec(first[c]) / nq);
+  }
+  return merged.results(lambda, shrinks, opt.keeppred);
+}
+
+#endif // LASSOSUM_ELNET_PATH_H
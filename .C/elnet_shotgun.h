@@ -0,0 +1,307 @@
+/**
+   lassosum
+   elnet_shotgun.h
+   Purpose: elnet on a single block with several threads
+
+   repelnet solves its blocks in parallel, but each block on one thread: a
+   few very large blocks, such as the MHC, are then left to run alone at the
+   end. Coordinate descent is sequential, each update seeing the previous
+   ones through the fitted values, but two SNPs in no LD can be updated at
+   once: the update of one does not change the cross product of the other.
+
+   The SNPs of the block are split into batches of SNPs in weak LD with each
+   other (see shotgunPlan). A sweep goes through the batches in turn: the
+   updates of the SNPs of a batch are computed concurrently from the same
+   fitted values, then added to them, each thread adding the updates of the
+   whole batch to its own share of the subjects, so that the result does
+   not depend on the number of threads. Only the pairs of SNPs within a
+   window of each other are known to be in weak LD: should the betas then
+   change more and more from one sweep to the next, the block is finished
+   by plain sweeps, one SNP at a time, from the betas before the last sweep.
+
+ */
+#ifndef LASSOSUM_ELNET_SHOTGUN_H
+#define LASSOSUM_ELNET_SHOTGUN_H
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cmath>
+#include <algorithm>
+#include <RcppArmadillo.h>
+#include "block_scheduler.h"
+#include "elnet_workspace.h"
+#include "elnet_band.h"
+
+/**
+   The batches of the SNPs of a block
+
+ */
+struct ShotgunPlan {
+  std::vector<int> snps;   // the SNPs of the block, 0-based, batch after batch
+  std::vector<int> start;  // the first SNP of each batch in snps, then snps.size()
+  arma::vec d;             // the squared norm of the genotypes of each SNP
+};
+
+/**
+   Splits the SNPs of a block into batches in weak LD
+
+   Two SNPs within window SNPs of each other whose correlation is at least
+   ldthr in absolute value are never in the same batch: the batches are the
+   colors of a greedy coloring of the graph of these pairs, the SNPs being
+   taken in order.
+
+   @G the standardized genotypes for one phenotype
+   @j0 the first SNP of the block, a column of G
+   @p the number of SNPs of the block
+   @window the number of SNPs after each SNP with which its LD is computed
+   @ldthr the correlation from which two SNPs are not updated at once
+   @nthreads number of threads used to compute the LD
+
+ */
+inline ShotgunPlan shotgunPlan(const arma::mat& G, int j0, int p, int window, double ldthr,
+                               int nthreads) {
+  int j, c;
+  arma::mat Gtouse(const_cast<double*>(G.colptr(j0)), G.n_rows, p, false, true);
+  arma::Col<int> end(p);
+  for(j=0; j < p; j++) end(j) = std::min(j + std::max(window, 0), p - 1);
+  arma::sp_mat R = bandedLD(Gtouse, end, ldthr, nthreads);
+
+  // Couleur de chaque SNP : la plus petite qui n'est pas celle d'un voisin avant lui
+  ShotgunPlan plan;
+  plan.d.zeros(p);
+  std::vector<int> color(p, 0), seen;
+  int ncolors = 0;
+  for(j=0; j < p; j++) {
+    for(arma::uword t=R.col_ptrs[j]; t < R.col_ptrs[j+1]; t++) {
+      int l = R.row_indices[t];
+      if(l == j) plan.d(j) = R.values[t];
+      else if(l < j) seen.push_back(color[l]);
+    }
+    std::sort(seen.begin(), seen.end());
+    c = 0;
+    for(size_t t=0; t < seen.size() && seen[t] <= c; t++) if(seen[t] == c) c++;
+    seen.clear();
+    color[j] = c;
+    ncolors = std::max(ncolors, c + 1);
+  }
+
+  plan.start.assign(ncolors + 1, 0);
+  for(j=0; j < p; j++) plan.start[color[j] + 1]++;
+  for(c=0; c < ncolors; c++) plan.start[c + 1] += plan.start[c];
+  std::vector<int> pos(plan.start.begin(), plan.start.end() - 1);
+  plan.snps.resize(p);
+  for(j=0; j < p; j++) plan.snps[pos[color[j]]++] = j;
+  return plan;
+}
+
+/**
+   A barrier for the threads of shotgunCore, which meet twice per batch.
+   A thread spins for a short while, the other threads being usually about
+   to arrive, then sleeps: it does not take the processor of the others when
+   there are more threads than cores, e.g. when the blocks are themselves
+   solved on a pool of threads.
+
+ */
+class ShotgunBarrier {
+public:
+  explicit ShotgunBarrier(int n) : n(n), count(0), phase(0) {}
+
+  void wait() {
+    int ph = phase.load();
+    if(count.fetch_add(1) + 1 == n) {
+      count.store(0);
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        phase.fetch_add(1);
+      }
+      wakeup.notify_all();
+      return;
+    }
+    for(int s=0; s < spins; s++) {
+      if(phase.load() != ph) return;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    wakeup.wait(lock, [&] { return phase.load() != ph; });
+  }
+
+private:
+  static const int spins = 4000;
+  int n;
+  std::atomic<int> count;
+  std::atomic<int> phase;
+  std::mutex mutex;
+  std::condition_variable wakeup;
+};
+
+/**
+   elnet on a block with several threads
+
+   The updates are those of elnetCore, on G, the genotypes for one
+   phenotype, as in floatCore.
+
+   @G the standardized genotypes for one phenotype
+   @j0 the first SNP of the block, a column of G
+   @plan the batches of the SNPs of the block (see shotgunPlan)
+   @scale the factor of G'G in t(X)*X, i.e. 1 - shrink
+   @r the correlations of the block
+   @x the betas of the block, updated in place
+   @ws the workspace: its yhat receives the fitted values of the block
+   before scaling, G times the betas of each trait, as an n x q matrix, and
+   it holds the scratch space of the call, sized on first use
+   @nthreads number of threads
+   @stats receives the statistics of the call
+   @abort when not NULL, shotgunCore stops early once it is set, and does
+   not call R; otherwise the calling thread watches for user interrupts
+   @return conv
+
+ */
+template <class Model>
+int shotgunCore(const Model& model, double lambda1, double lambda2, const arma::mat& G, int j0,
+                const ShotgunPlan& plan, double scale, const double* r, double thr, double* x,
+                ElnetWorkspace& ws, int nthreads, int trace, int maxiter, ElnetStats& stats,
+                const std::atomic<bool>* abort) {
+  int q = model.q();
+  int n = G.n_rows;
+  int p = plan.snps.size();
+  int nbatches = (int) plan.start.size() - 1;
+  int nt = std::max(1, std::min(nthreads, n));
+
+  int maxbatch = 0;
+  for(int b=0; b < nbatches; b++) maxbatch = std::max(maxbatch, plan.start[b+1] - plan.start[b]);
+  double* yhat = ws.yhat.memptr();
+  std::vector<double>& del = ws.shotgundel;
+  std::vector<double>& xbefore = ws.shotgunx;
+  std::vector<double>& threaddlx = ws.shotgundlx;
+  if(del.size() < (size_t) maxbatch * q) del.resize((size_t) maxbatch * q);
+  xbefore.assign(x, x + (size_t) p * q);
+  threaddlx.assign(nt, 0.0);
+  ShotgunBarrier barrier(nt);
+
+  // Décisions prises par le thread 0 entre deux sweeps
+  int m = 0, conv = 0;
+  bool sequential = false, refit = false, finished = false, interrupted = false;
+  double bestdlx = arma::datum::inf;
+
+  // La mise à jour de x[q*j+k], dont elle renvoie la variation
+  auto update = [&](int j, int k, const double* y) {
+    int c = q*j+k;
+    const double* g = G.colptr(j0 + j);
+    double s = 0.0;
+    for(int i=0; i < n; i++) s += g[i] * y[i];
+    double dj = plan.d(j);
+    double denom = scale * dj + lambda2;
+    double S = scale * (s - dj * x[c]);
+    double A = model.t1(q, k, x + q*j, denom) + model.t2(q, k, r + q*j) + model.t3(k, S);
+    double v = 0.0;
+    if (A + lambda1 < 0) v = (A + lambda1)/model.denominator(k, denom);
+    if (A - lambda1 > 0) v = (A - lambda1)/model.denominator(k, denom);
+    double dl = v - x[c];
+    x[c] = v;
+    return dl;
+  };
+
+  // yhat = G x, sur les lignes [i0, i1)
+  auto fitted = [&](int i0, int i1) {
+    for(int k=0; k < q; k++) std::fill(yhat + (size_t) n*k + i0, yhat + (size_t) n*k + i1, 0.0);
+    for(int j=0; j < p; j++) {
+      const double* g = G.colptr(j0 + j);
+      for(int k=0; k < q; k++) {
+        double a = x[q*j+k];
+        if(a == 0.0) continue;
+        double* y = yhat + (size_t) n*k;
+        for(int i=i0; i < i1; i++) y[i] += a * g[i];
+      }
+    }
+  };
+
+  auto team = [&](int thread) {
+    int i0 = (int) ((long long) n * thread / nt), i1 = (int) ((long long) n * (thread + 1) / nt);
+    fitted(i0, i1);
+    barrier.wait();
+    while(!finished) {
+      double dlx = 0.0;
+      if(!sequential) {
+        for(int b=0; b < nbatches; b++) {
+          int a0 = plan.start[b], a1 = plan.start[b+1];
+          // Les SNPs du lot sont mis à jour à partir des mêmes yhat
+          for(int u=a0 + thread; u < a1; u += nt) {
+            int j = plan.snps[u];
+            for(int k=0; k < q; k++) {
+              double dl = update(j, k, yhat + (size_t) n*k);
+              del[(size_t) q*(u-a0)+k] = dl;
+              dlx = std::max(dlx, std::abs(dl));
+            }
+          }
+          barrier.wait();
+          // Puis chaque thread ajoute leurs variations à ses lignes de yhat
+          for(int u=a0; u < a1; u++) {
+            const double* g = G.colptr(j0 + plan.snps[u]);
+            for(int k=0; k < q; k++) {
+              double dl = del[(size_t) q*(u-a0)+k];
+              if(dl == 0.0) continue;
+              double* y = yhat + (size_t) n*k;
+              for(int i=i0; i < i1; i++) y[i] += dl * g[i];
+            }
+          }
+          barrier.wait();
+        }
+      } else if(thread == 0) {
+        for(int j=0; j < p; j++) {
+          const double* g = G.colptr(j0 + j);
+          for(int k=0; k < q; k++) {
+            double* y = yhat + (size_t) n*k;
+            double dl = update(j, k, y);
+            if(dl == 0.0) continue;
+            dlx = std::max(dlx, std::abs(dl));
+            for(int i=0; i < n; i++) y[i] += dl * g[i];
+          }
+        }
+      }
+      threaddlx[thread] = dlx;
+      barrier.wait();
+
+      if(thread == 0) {
+        dlx = 0.0;
+        for(int t=0; t < nt; t++) dlx = std::max(dlx, threaddlx[t]);
+        m++;
+        if(abort == NULL) {
+          if(pendingInterrupt()) interrupted = true;
+          if(trace > 0) Rcpp::Rcout << "Iteration: " << m - 1 << "\n";
+        }
+        refit = !sequential && (!std::isfinite(dlx) || (m > 2 && dlx > 2.0 * bestdlx));
+        if(refit) {
+          // Les lots ont fait diverger les betas : on repart de ceux d'avant ce sweep,
+          // un SNP à la fois
+          std::copy(xbefore.begin(), xbefore.end(), x);
+          sequential = true;
+          if(trace > 0 && abort == NULL)
+            Rcpp::Rcout << "Shotgun: sequential sweeps from iteration " << m - 1 << "\n";
+        } else {
+          bestdlx = std::min(bestdlx, dlx);
+          if(dlx < thr) conv = 1;
+        }
+        finished = conv || m >= maxiter || interrupted || (abort != NULL && abort->load());
+        if(!finished) std::copy(x, x + (size_t) p * q, xbefore.begin());
+      }
+      barrier.wait();
+      if(refit && !finished) {
+        fitted(i0, i1);
+        barrier.wait();
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for(int t=1; t < nt; t++) threads.push_back(std::thread(team, t));
+  team(0);
+  for(size_t t=0; t < threads.size(); t++) threads[t].join();
+
+  stats.sweeps = m;
+  if(interrupted) throw Rcpp::internal::InterruptedException();
+  return conv;
+}
+
+#endif
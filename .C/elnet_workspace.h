@@ -0,0 +1,289 @@
+/**
+   lassosum
+   elnet_workspace.h
+   Purpose: scratch memory reused by every call to elnet
+
+   elnet used to allocate its working vectors on every call, and repelnet
+   the block's x and yhat, i.e. once per block and per lambda. The
+   workspace is sized once for the largest block; elnet then works on views
+   of it, so that solving performs no heap allocation after the setup.
+   Every thread solving blocks needs its own workspace.
+
+   It also holds the options of elnet, its statistics, and the pieces of the
+   Anderson acceleration that do not depend on the model.
+
+ */
+#ifndef LASSOSUM_ELNET_WORKSPACE_H
+#define LASSOSUM_ELNET_WORKSPACE_H
+
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <RcppArmadillo.h>
+
+// Update schemes of elnet. JACOBI computes the updates of a sweep from the
+// betas at the start of the sweep; the others are Gauss-Seidel, using every
+// update as soon as it is made, and differ in the order the SNPs are visited.
+enum ElnetScheme { JACOBI = 0, CYCLIC = 1, RANDOM = 2, GREEDY = 3 };
+
+// Options of elnet
+struct ElnetControl {
+  int scheme;   // an ElnetScheme
+  int anderson; // number of differences of iterates used by the Anderson
+                // acceleration, 0 for none
+  double gaptol; // if > 0, stop once the duality gap is below gaptol times the
+                 // objective, and screen out the betas proven to be zero
+                 // (see elnet_gap.h); if 0, stop once the betas change by less
+                 // than thr in a sweep
+  int gapevery;  // the gap is computed every gapevery sweeps
+  bool joint;    // update the q betas of a SNP jointly rather than one at a time
+
+  ElnetControl(int scheme, int anderson = 0, double gaptol = 0.0, bool joint = false) :
+    scheme(scheme), anderson(anderson), gaptol(gaptol), gapevery(10), joint(joint) {}
+};
+
+// Statistics of a call to elnet
+struct ElnetStats {
+  int sweeps;         // number of sweeps
+  int extrapolations; // number of Anderson extrapolations accepted
+  int screened;       // number of betas screened out
+  double gap;         // last duality gap computed, NaN if none
+  double ldhits;      // LD columns found in the cache (see elnet_ldcolumns.h)
+  double ldmisses;    // LD columns computed
+
+  ElnetStats() : sweeps(0), extrapolations(0), screened(0), gap(arma::datum::nan),
+                 ldhits(0.0), ldmisses(0.0) {}
+};
+
+struct ElnetWorkspace {
+  arma::vec x_before;    // the betas at the start of a sweep
+  arma::vec yhat;        // the fitted values of the block being solved
+  arma::vec yhat_before; // the fitted values at the start of a sweep
+  std::vector<int> order; // the order in which the SNPs are visited
+  arma::vec priority;    // largest change of each SNP's betas in the last sweep
+
+  // Anderson acceleration, empty when it is not used
+  arma::mat xhist;       // the betas after each of the last anderson+1 sweeps
+  arma::mat UtU;         // Gram matrix of the differences of the iterates
+  arma::vec weights;     // extrapolation weights
+  arma::vec xacc;        // the extrapolated betas
+  arma::vec yacc;        // their fitted values
+
+  // Duality gap and screening (see elnet_gap.h)
+  std::vector<char> active; // 0 for the betas screened out
+  arma::vec b;           // linear term of the objective
+  arma::vec grad;        // b - Hx, minus the gradient of its smooth part
+  arma::vec gapD;        // scale of each trait in L
+  arma::mat gapP;        // the q x q matrix P
+  arma::mat gapC;        // its Cholesky factor
+  arma::vec gapz;
+  double gapY;           // b'(I_p (x) P^-1)b
+
+  // Joint update of the q betas of a SNP
+  arma::vec jointS;      // cross products with the other SNPs, for each trait
+
+  // One trait of a block, solved on its own when the traits are independent
+  arma::vec traitr;      // its correlations
+  arma::vec traitdiag;   // its diag
+  arma::vec traitx;      // its betas
+
+  // The fitted values of a block in single precision (see elnet_float.h),
+  // sized on first use
+  arma::fvec fyhat;
+
+  // The LD times the betas of a block (see elnet_ldcolumns.h), sized on first use
+  arma::vec Rx;
+
+  // The updates of a batch, the betas before a sweep and the largest change of
+  // each thread in shotgunCore (see elnet_shotgun.h), sized on first use
+  std::vector<double> shotgundel;
+  std::vector<double> shotgunx;
+  std::vector<double> shotgundlx;
+
+  ElnetWorkspace(int len, int nrows, int anderson = 0) :
+    x_before(len, arma::fill::zeros),
+    yhat(nrows, arma::fill::zeros),
+    yhat_before(nrows, arma::fill::zeros),
+    order(len, 0),
+    priority(len, arma::fill::zeros),
+    xhist(anderson > 0 ? len : 0, anderson > 0 ? anderson + 1 : 0),
+    UtU(anderson, anderson),
+    weights(anderson),
+    xacc(anderson > 0 ? len : 0),
+    yacc(anderson > 0 ? nrows : 0),
+    active(len, 1),
+    b(len, arma::fill::zeros),
+    grad(len, arma::fill::zeros),
+    gapY(0.0),
+    traitr(len),
+    traitdiag(len),
+    traitx(len) {}
+};
+
+/**
+   Allocates one workspace per thread
+
+   @startvec first column of each block
+   @endvec last column of each block
+   @nrows number of rows of the genotype matrix
+   @nthreads number of threads
+   @anderson the anderson option of elnet (see ElnetControl)
+   @return the workspaces, sized for the largest block
+
+ */
+inline std::vector<ElnetWorkspace> elnetWorkspaces(const arma::Col<int>& startvec,
+                                                   const arma::Col<int>& endvec,
+                                                   int nrows, int nthreads,
+                                                   int anderson = 0) {
+  int len=0;
+  for(int i=0; i < startvec.n_elem; i++)
+    len=std::max(len, endvec(i) - startvec(i) + 1);
+  return std::vector<ElnetWorkspace>(std::max(nthreads, 1), ElnetWorkspace(len, nrows, anderson));
+}
+
+/**
+   Orders the SNPs for a sweep of elnet
+
+   JACOBI and CYCLIC visit the SNPs in order, RANDOM in a new random
+   permutation every sweep, and GREEDY the SNPs whose betas changed the most
+   in the previous sweep first (Gauss-Southwell order). Call with first = true
+   at the start of elnet.
+
+   @scheme an ElnetScheme
+   @p number of SNPs in the block
+   @ws the workspace holding the order
+   @rng random number generator for RANDOM
+   @first whether this is the first sweep
+
+ */
+inline void sweepOrder(int scheme, int p, ElnetWorkspace& ws, std::mt19937& rng,
+                       bool first) {
+  std::vector<int>::iterator begin = ws.order.begin();
+  if(first) {
+    for(int j=0; j < p; j++) {
+      ws.order[j]=j;
+      ws.priority.at(j)=0.0;
+    }
+  }
+  if(scheme == RANDOM) {
+    std::shuffle(begin, begin + p, rng);
+  } else if(scheme == GREEDY && !first) {
+    // std::sort rather than std::stable_sort, which allocates a buffer
+    const arma::vec& priority = ws.priority;
+    std::sort(begin, begin + p, [&](int a, int b) {
+      if(priority.at(a) != priority.at(b)) return priority.at(a) > priority.at(b);
+      return a < b;
+    });
+  }
+}
+
+/**
+   Non-owning view of the first len elements of a workspace vector
+
+ */
+inline arma::vec workspaceView(arma::vec& v, int len) {
+  return arma::vec(v.memptr(), len, false, true);
+}
+
+/**
+   Dot product of column c of X with y, read in place
+
+ */
+inline double colDot(const arma::mat& X, int c, const arma::vec& y) {
+  const double* xc = X.colptr(c);
+  const double* yp = y.memptr();
+  double s = 0.0;
+  for(int i=0; i < X.n_rows; i++) s += xc[i] * yp[i];
+  return s;
+}
+
+/**
+   Computes the weights of an Anderson extrapolation
+
+   With the betas x_0, ..., x_K of the last K+1 sweeps in the columns of
+   ws.xhist, oldest first, and U the matrix of their differences
+   x_1 - x_0, ..., x_K - x_{K-1}, the weights w minimise |U w| subject to
+   sum(w) = 1, i.e. w is proportional to the solution of (U'U) z = 1. The
+   extrapolated betas are then sum_k w_k x_k (see andersonPoint), except
+   for the betas screened out, which stay at zero. U'U is
+   usually near singular, so it is regularised slightly. The small system is
+   solved in place, by Gaussian elimination, to stay free of allocations.
+
+   @ws the workspace, receiving the weights in ws.weights
+   @K the anderson option of elnet
+   @len number of betas
+   @return false if there is nothing to extrapolate from
+
+ */
+inline bool andersonWeights(ElnetWorkspace& ws, int K, int len) {
+  arma::mat& G = ws.UtU;
+  arma::vec& z = ws.weights;
+  int a, b, c;
+
+  for(a=0; a < K; a++) {
+    const double* ua0 = ws.xhist.colptr(a);
+    const double* ua1 = ws.xhist.colptr(a + 1);
+    for(b=0; b <= a; b++) {
+      const double* ub0 = ws.xhist.colptr(b);
+      const double* ub1 = ws.xhist.colptr(b + 1);
+      double s = 0.0;
+      for(c=0; c < len; c++) s += (ua1[c] - ua0[c]) * (ub1[c] - ub0[c]);
+      G.at(a,b) = s;
+      G.at(b,a) = s;
+    }
+  }
+
+  double tr = 0.0;
+  for(a=0; a < K; a++) tr += G.at(a,a);
+  if(!(tr > 0.0)) return false;
+  for(a=0; a < K; a++) {
+    G.at(a,a) += 1e-10 * tr;
+    z.at(a) = 1.0;
+  }
+
+  // Gaussian elimination with partial pivoting
+  for(a=0; a < K; a++) {
+    int piv = a;
+    for(b=a+1; b < K; b++)
+      if(std::abs(G.at(b,a)) > std::abs(G.at(piv,a))) piv = b;
+    if(G.at(piv,a) == 0.0) return false;
+    if(piv != a) {
+      for(c=0; c < K; c++) std::swap(G.at(a,c), G.at(piv,c));
+      std::swap(z.at(a), z.at(piv));
+    }
+    for(b=a+1; b < K; b++) {
+      double f = G.at(b,a) / G.at(a,a);
+      for(c=a; c < K; c++) G.at(b,c) -= f * G.at(a,c);
+      z.at(b) -= f * z.at(a);
+    }
+  }
+  for(a=K-1; a >= 0; a--) {
+    double s = z.at(a);
+    for(c=a+1; c < K; c++) s -= G.at(a,c) * z.at(c);
+    z.at(a) = s / G.at(a,a);
+  }
+
+  double sum = 0.0;
+  for(a=0; a < K; a++) sum += z.at(a);
+  if(sum == 0.0 || !std::isfinite(sum)) return false;
+  for(a=0; a < K; a++) z.at(a) /= sum;
+  return true;
+}
+
+/**
+   The extrapolated betas sum_k w_k x_k, k = 1..K (see andersonWeights)
+
+ */
+inline void andersonPoint(const ElnetWorkspace& ws, int K, int len, arma::vec& xacc) {
+  xacc.zeros();
+  for(int a=0; a < K; a++) {
+    const double* xa = ws.xhist.colptr(a + 1);
+    double w = ws.weights.at(a);
+    for(int c=0; c < len; c++) xacc.at(c) += w * xa[c];
+  }
+  for(int c=0; c < len; c++)
+    if(!ws.active[c]) xacc.at(c) = 0.0;
+}
+
+#endif
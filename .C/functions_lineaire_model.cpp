@@ -18,104 +18,18 @@
 #include <algorithm>
 #include <iostream>
 #include <cmath>
+#include <chrono>
 #include <RcppArmadillo.h>
+#include "block_scheduler.h"
+#include "elnet_workspace.h"
+#include "elnet_core.h"
+#include "plink_bed.h"
+#include "elnet_path.h"
 
 // [[Rcpp::depends(RcppArmadillo)]]
+// [[Rcpp::plugins(cpp11)]]
 using namespace Rcpp;
 
-/**
- 	Opens a Plink binary files
-
-	@s file name
-	@BIT ifstream
-	@return is plink file in major mode
-
-*/
-
-bool openPlinkBinaryFile(const std::string s, std::ifstream &BIT) {
-  BIT.open(s.c_str(), std::ios::in | std::ios::binary);
-  if (!BIT.is_open()) {
-    throw "Cannot open the bed file";
-  }
-
-  // 2) else check for 0.99 SNP/Ind coding
-  // 3) else print warning that file is too old
-  char ch[1];
-  BIT.read(ch, 1);
-  std::bitset<8> b;
-  b = ch[0];
-  bool bfile_SNP_major = false;
-  bool v1_bfile = true;
-  // If v1.00 file format
-  // Magic numbers for .bed file: 00110110 11011000 = v1.00 bed file
-  // std::cerr << "check magic number" << std::endl;
-  if ((b[2] && b[3] && b[5] && b[6]) && !(b[0] || b[1] || b[4] || b[7])) {
-    // Next number
-    BIT.read(ch, 1);
-    b = ch[0];
-    if ((b[0] && b[1] && b[3] && b[4]) && !(b[2] || b[5] || b[6] || b[7])) {
-      // Read SNP/Ind major coding
-      BIT.read(ch, 1);
-      b = ch[0];
-      if (b[0])
-        bfile_SNP_major = true;
-      else
-        bfile_SNP_major = false;
-
-      // if (bfile_SNP_major) std::cerr << "Detected that binary PED file is
-      // v1.00 SNP-major mode" << std::endl;
-      // else std::cerr << "Detected that binary PED file is v1.00
-      // individual-major mode" << std::endl;
-
-    } else
-      v1_bfile = false;
-
-  } else
-    v1_bfile = false;
-  // Reset file if < v1
-  if (!v1_bfile) {
-    Rcerr << "Warning, old BED file <v1.00 : will try to recover..."
-              << std::endl;
-    Rcerr << "  but you should --make-bed from PED )" << std::endl;
-    BIT.close();
-    BIT.clear();
-    BIT.open(s.c_str(), std::ios::in | std::ios::binary);
-    BIT.read(ch, 1);
-    b = ch[0];
-  }
-  // If 0.99 file format
-  if ((!v1_bfile) && (b[1] || b[2] || b[3] || b[4] || b[5] || b[6] || b[7])) {
-    Rcerr << std::endl
-              << " *** Possible problem: guessing that BED is < v0.99      *** "
-              << std::endl;
-    Rcerr << " *** High chance of data corruption, spurious results    *** "
-              << std::endl;
-    Rcerr
-        << " *** Unless you are _sure_ this really is an old BED file *** "
-        << std::endl;
-    Rcerr << " *** you should recreate PED -> BED                      *** "
-              << std::endl
-              << std::endl;
-    bfile_SNP_major = false;
-    BIT.close();
-    BIT.clear();
-    BIT.open(s.c_str(), std::ios::in | std::ios::binary);
-  } else if (!v1_bfile) {
-    if (b[0])
-      bfile_SNP_major = true;
-    else
-      bfile_SNP_major = false;
-    Rcerr << "Binary PED file is v0.99" << std::endl;
-    if (bfile_SNP_major)
-      Rcerr << "Detected that binary PED file is in SNP-major mode"
-                << std::endl;
-    else
-      Rcerr << "Detected that binary PED file is in individual-major mode"
-                << std::endl;
-  }
-  return bfile_SNP_major;
-}
-
 //' Count number of lines in a text file
 //'
 //' @param fileName Name of file
@@ -388,6 +302,127 @@ arma::mat multiBed3sp(const std::string fileName, int N, int P,
 }
 
 
+//' Converts sparse betas to the input of multiBed3sp
+//'
+//' @param beta the betas, a (p*q) x nlambda sparse matrix (see runElnet)
+//' @param q number of phenotypes
+//' @return a list with the arguments beta, nonzeros, colpos and ncol of multiBed3sp:
+//' the nonzero betas SNP by SNP, their number for each SNP, and their column in the
+//' result, l*q+k for trait k and lambda l (0-based)
+//' @keywords internal
+//'
+// [[Rcpp::export]]
+List multiBed3spInput(const arma::sp_mat& beta, int q) {
+  return sparseBetaInput(beta, q);
+}
+
+
+// The linear model, for the solver of elnet_core.h. The update of x(q*j+k) has
+// t1 = sum_{h != k} Inv_Sigma(k,k)*x(q*j+h)*denom,
+// t2 = -2*sum_h Inv_Sigma(k,h)*r(q*j+h), t3 = 2*Inv_Sigma(k,k)*S and the
+// denominator Inv_Sigma(k,k)*denom.
+//
+// The updates are a coordinate descent of 0.5*x'Hx - x'b + lambda1*sum(abs(x)),
+// for the betas x and yhat = X*x, where b(q*j+k) is t2, H has
+// -2*Inv_Sigma(k,k)*t(X[,q*j+k])*X[,q*l+k] between SNPs j != l (t3),
+// -Inv_Sigma(k,k)*denom between the traits of a SNP (t1), and the denominator
+// of the update on its diagonal.
+//
+// For the paths of elnet_path.h, loss is yhat'yhat - 2*x'r and fbeta adds
+// lambda2*x'x to its penalty: Inv_Sigma does not enter them. The results hold
+// the sd of each SNP.
+
+struct LinearModel {
+  arma::mat Inv_Sigma;
+  static const bool snpSd = true;
+
+  LinearModel(const arma::mat& Inv_Sigma) : Inv_Sigma(Inv_Sigma) {}
+
+  int q() const { return Inv_Sigma.n_cols; }
+
+  double t1(int q, int k, const double* xj, double denom) const {
+    double t1 = 0.0;
+    for(int h=0; h < q; h++) {
+      if(h != k) t1 = t1 + Inv_Sigma.at(k,k)*xj[h]*denom;
+    }
+    return t1;
+  }
+
+  double t2(int q, int k, const double* rj) const {
+    double t2 = 0.0;
+    for(int h=0; h < q; h++) t2 = t2 + Inv_Sigma.at(k,h)*rj[h];
+    return -2*t2;
+  }
+
+  double t3(int k, double S) const { return 2*Inv_Sigma.at(k,k)*S; }
+
+  double denominator(int k, double denom) const { return Inv_Sigma.at(k,k)*denom; }
+
+  double objective(double lambda1, double lambda2, const arma::vec& diag, const arma::vec& r,
+                   const arma::vec& x, const arma::vec& yhat) const {
+    int q = Inv_Sigma.n_cols;
+    int p = x.n_elem / q;
+    int n = yhat.n_elem / q;
+    double quad = 0.0, lin = 0.0, l1 = 0.0;
+    int i, j, k, h;
+
+    // Rows q*i+k of X are those of trait k, so that sum_i yhat(q*i+k)^2 is
+    // the quadratic form of trait k over all SNPs, diagonal included
+    for(k=0; k < q; k++) {
+      double yy = 0.0;
+      for(i=0; i < n; i++) yy += yhat.at(q*i+k) * yhat.at(q*i+k);
+      quad += -2 * Inv_Sigma.at(k,k) * yy;
+    }
+    for(j=0; j < p; j++) {
+      for(k=0; k < q; k++) {
+        double xc = x.at(q*j+k);
+        if(xc == 0.0) continue;
+        double denom = diag.at(q*j+k) + lambda2;
+        quad += Inv_Sigma.at(k,k) * (denom + 2 * diag.at(q*j+k)) * xc * xc;
+        for(h=0; h < q; h++) {
+          if(h != k) quad -= Inv_Sigma.at(k,k) * denom * xc * x.at(q*j+h);
+          lin += -2 * Inv_Sigma.at(k,h) * r.at(q*j+h) * xc;
+        }
+        l1 += std::abs(xc);
+      }
+    }
+    return 0.5 * quad - lin + lambda1 * l1;
+  }
+
+  // Contrairement au modèle mixte, ce modèle n'est pas convexe tel qu'il est écrit (t3 a
+  // le signe opposé) : H ne s'écrit pas H = L'L + I_p (x) P (voir elnet_gap.h), il n'y a
+  // pas de saut de dualité, et on s'arrête sur dlx quel que soit ctrl.gaptol
+  bool gap(int q, double lambda2, arma::vec& D, arma::mat& P) const { return false; }
+
+  bool convex() const { return false; }
+
+  // t1 couple les traits même quand Inv_Sigma est diagonale
+  bool separable() const { return false; }
+
+  LinearModel trait(int k) const {
+    arma::mat Sigma(1, 1);
+    Sigma(0,0) = Inv_Sigma(k,k);
+    return LinearModel(Sigma);
+  }
+
+  arma::mat lossWeights(const arma::mat& R) const { return R; }
+
+  // The quadratic forms are sums of squares: dot() computes them without the
+  // temporary vectors of pow() and %
+  double fittedQuad(const double* yhat, int n, arma::mat& s) const {
+    arma::vec y(const_cast<double*>(yhat), Inv_Sigma.n_cols * n, false, true);
+    return arma::dot(y, y);
+  }
+
+  double ldQuad(const arma::mat& xb, const arma::mat& R) const {
+    return arma::accu((xb * R) % xb);
+  }
+
+  double betaQuad(const arma::mat& xq, double lambda2, arma::mat& s1, arma::mat& s2) const {
+    return arma::dot(xq, xq) * lambda2;
+  }
+};
+
 
 //' Performs elnet
 //'
@@ -401,29 +436,18 @@ arma::mat multiBed3sp(const std::string fileName, int N, int P,
 //' @param yhat A vector
 //' @param trace if >1 displays the current iteration
 //' @param maxiter maximal number of iterations
+//' @param scheme update scheme: 0 Jacobi, 1 cyclic Gauss-Seidel, 2 Gauss-Seidel
+//' in a random order, 3 Gauss-Seidel in greedy (largest change first) order.
+//' There is no Anderson acceleration: the objective of the linear model is not
+//' convex, so that a decrease of it does not make an extrapolation safe
 //' @return conv
 //' @keywords internal
 //'
 // [[Rcpp::export]]
-
 int elnet(double lambda1, double lambda2, const arma::vec& diag, const arma::mat& X,
-          const arma::vec& r, const arma ::mat& Inv_Sigma, double thr, arma::vec& x, arma::vec& yhat, int trace, int maxiter)
+          const arma::vec& r, const arma ::mat& Inv_Sigma, double thr, arma::vec& x, arma::vec& yhat, int trace, int maxiter,
+          int scheme=0)
 {
-
-
-  // diag is basically diag(X'X)
-  // Also, ensure that the yhat=X*x in the input. Usually, both x and yhat are preset to 0.
-  // They are modified in place in this function.
-
-
-  //on n'a pas besoin de cet élément
-  //int nq =X.n_rows;
-
-  int pq =X.n_cols;
-  int q = Inv_Sigma.n_cols;
-  int p = (pq)/(q);
-
-
   // avant je comparais r.n_elem avec pq, mais on me donnait warning, donc je compare directement
   // r.n_elem avec X.n_cols, pareil pour les autres
   if(r.n_elem != X.n_cols) stop("r.n_elem != X.n_cols");
@@ -431,137 +455,25 @@ int elnet(double lambda1, double lambda2, const arma::vec& diag, const arma::mat
   if(yhat.n_elem != X.n_rows) stop("yhat.n_elem != X.n_rows");
   if(diag.n_elem != X.n_cols) stop("diag.n_elem != X.n_cols");
 
-  double dlx,del,t1,t2,t3, A,S ;
-
-  // j : indice des SNPs, k : indice des traits, m: indice des itérations, u indice pour parcourir le vecteur x ( des betas ),
-  // h indice utilisé pour définir t1 , l incide utilisé pour définir t3
-  int j,k,m,u,h,l;
-
-  // On définit le vecteur x_before ( qui contient les valeurs des betas à l'itération t-1 )
-  arma :: vec x_before(pq,arma::fill::zeros);
-
-  arma::vec Lambda2(pq);
-
-  Lambda2.fill(lambda2);
-  arma::vec denom=diag + Lambda2;
-
-  // On définit le vecteur C , on en aura besoin pour le calcul du terme t3, c'est t(Xj)*Xl*Betal, un vecteur
-  // de taille q
-  arma::vec C(q);
-
-  int conv=0;
-
-  for(m=0;m<maxiter ;m++) {
-    dlx=0.0;
-      // Mon beta est x : c'est un vecteur de taille pq : x = ( q betas pour le SNP1 , q betas pour le SNP 2, .., q betas pour le SNP p )
-
-      x_before = x;
-
-      // boucle sur les SNPS :
-      for (j= 0; j<p; j++) {
-
-        // Pour chaque SNP, on fait une boucle sur les traits :
-        for(k=0; k < q; k++) {
-
-          x.at(q*j+k)=0.0;
-
-
-          // On initialise les termes dont on aura besoin : t1, t2 et t3 ( ce sont les 3 composantes de A comme définie dans la partie théorique )
-          // ainsi que A et S
-
-          t1 = 0.0 ;
-          t2 = 0.0 ;
-          t3 = 0.0 ;
-          A = 0.0 ;
-          S = 0.0 ;
-
-          // RMQ : c++ commence à indicer à partir de 0 ( le premier élément d'un vecteur à l'indice 0),
-          // alors que R commence à indicer à partir de 1 ( le premier élément d'un vecteur à l'indice 1 )
-
-          // On définit le terme t1 :
-
-          for (h =0 ; h<q;h++){
-            if (h!=k) t1=t1+ Inv_Sigma.at(k,k)*x_before.at(q*j+h)*denom.at(q*j+k);
-          }
-
-          // On définit le terme t2 :
-
-          t2 = -2*(arma::dot(Inv_Sigma.row(k),r.subvec(q*j,q*(j+1)-1)))  ;
-
-          // On définit le terme t3 :
-
-          for(l=0; l< p;l++){
-            C = trans(X.cols(q*j,q*(j+1)-1))*X.cols(q*l,q*(l+1)-1)*x_before.subvec(q*l,q*(l+1)-1);
-            if(l!=j) S = S + C.at(k);
-          }
-
-          t3 = 2*Inv_Sigma.at(k,k)*S;
-
-          A=t1+t2+t3;
-
-          // On définit maintenant la solution Beta
-
-          if (A < 0){
-            if (A + lambda1 <0 ) {
-              x.at(q*j+k) = (A+ lambda1)/(Inv_Sigma.at(k,k)*denom.at(q*j+k));
-            }
-          }
-
-          if (A > 0){
-            if (A - lambda1> 0){
-              x.at(q*j+k) = (A- lambda1)/(Inv_Sigma.at(k,k)*denom.at(q*j+k));
-              }
-          }
-
-          if (x.at(q*j+k)==x_before.at(q*j+k) ) continue;
-          del = x.at(q*j+k)-x_before.at(q*j+k);
-          dlx=std::max(dlx,std::abs(del));
-
-          yhat += del*X.col(q*j+k);
-
-        }
-
-      }
-
-    checkUserInterrupt();
-    if(trace > 0) Rcout << "Iteration: " << m << "\n";
-
-    if(dlx < thr) {
-      conv=1;
-      break;
-    }
-  }
-
-  return conv;
+  ElnetWorkspace ws(X.n_cols, X.n_rows);
+  ElnetStats stats;
+  return elnetCoreFor<LinearModel>(Inv_Sigma.n_cols)(LinearModel(Inv_Sigma), lambda1, lambda2,
+                                                     diag, X, r, thr, x, yhat, trace, maxiter,
+                                                     ElnetControl(scheme), ws, stats, NULL);
 }
 
 
 // [[Rcpp::export]]
 int repelnet(double lambda1, double lambda2, arma::vec& diag, arma::mat& X, arma::vec& r, arma ::mat& Inv_Sigma,
              double thr, arma::vec& x, arma::vec& yhat, int trace, int maxiter,
-             arma::Col<int>& startvec, arma::Col<int>& endvec)
+             arma::Col<int>& startvec, arma::Col<int>& endvec, int nthreads=1,
+             int scheme=0)
 {
-
-  // Repeatedly call elnet by blocks...
-  int nreps=startvec.n_elem;
-  int out=1;
-  for(int i=0;i < startvec.n_elem; i++) {
-    arma::vec xtouse=x.subvec(startvec(i), endvec(i));
-    arma::vec yhattouse=X.cols(startvec(i), endvec(i)) * xtouse;
-
-    int out2=elnet(lambda1, lambda2,
-                   diag.subvec(startvec(i), endvec(i)),
-                   X.cols(startvec(i), endvec(i)),
-                   r.subvec(startvec(i), endvec(i)),
-                   Inv_Sigma,
-                   thr, xtouse,
-                   yhattouse, trace - 1, maxiter);
-    x.subvec(startvec(i), endvec(i))=xtouse;
-    yhat += yhattouse;
-    if(trace > 0) Rcout << "Block: " << i << "\n";
-    out=std::min(out, out2);
-  }
-  return out;
+  std::vector<ElnetWorkspace> ws=elnetWorkspaces(startvec, endvec, X.n_rows, nthreads);
+  std::vector<ElnetStats> stats(startvec.n_elem);
+  return repelnetCore(LinearModel(Inv_Sigma), lambda1, lambda2, diag, X, r, thr, x, yhat,
+                      trace, maxiter, startvec, endvec, nthreads, elnetCoreFor<LinearModel>(Inv_Sigma.n_cols),
+                      ElnetControl(scheme), ws, stats, std::vector<char>(startvec.n_elem, 0));
 }
 
 //' imports genotypeMatrix
@@ -581,93 +493,8 @@ arma::mat genotypeMatrix(const std::string fileName, int N, int P,
                          arma::Col<int> col_skip_pos, arma::Col<int> col_skip,
                          arma::Col<int> keepbytes, arma::Col<int> keepoffset,
 						 const int fillmissing) {
-
-  std::ifstream bedFile;
-  bool snpMajor = openPlinkBinaryFile(fileName, bedFile);
-
-  if (!snpMajor)
-    throw std::runtime_error("We currently have no plans of implementing the "
-                             "individual-major mode. Please use the snp-major "
-                             "format");
-
-  int i = 0;
-  int ii = 0;
-  const bool colskip = (col_skip_pos.n_elem > 0);
-  unsigned long long int Nbytes = ceil(N / 4.0);
-  const bool selectrow = (keepbytes.n_elem > 0);
-  int n, p, nskip;
-  if (selectrow)
-    n = keepbytes.n_elem;
-  else
-    n = N;
-
-  if (colskip) {
-    nskip = arma::accu(col_skip);
-    p = P - nskip;
-  }  else
-    p = P;
-
-  int j, jj, iii;
-
-  arma::mat genotypes = arma::mat(n, p, arma::fill::zeros);
-  std::bitset<8> b; // Initiate the bit array
-  char ch[Nbytes];
-
-  iii=0;
-  while (i < P) {
-  // Rcout << i << std::endl;
-    Rcpp::checkUserInterrupt();
-    if (colskip) {
-      if (ii < col_skip.n_elem) {
-        if (i == col_skip_pos[ii]) {
-          bedFile.seekg(col_skip[ii] * Nbytes, bedFile.cur);
-          i = i + col_skip[ii];
-          ii++;
-          continue;
-        }
-      }
-    }
-
-    bedFile.read(ch, Nbytes); // Read the information
-    if (!bedFile)
-      throw std::runtime_error(
-          "Problem with the BED file...has the FAM/BIM file been changed?");
-
-    j = 0;
-    if (!selectrow) {
-      for (jj = 0; jj < Nbytes; jj++) {
-        b = ch[jj];
-
-        int c = 0;
-        while (c < 7 &&
-               j < N) { // from the original PLINK: 7 because of 8 bits
-          int first = b[c++];
-          int second = b[c++];
-          if (first == 0) {
-            genotypes(j, iii) = (2 - second);
-          }
-          if(fillmissing == 0 && first == 1 && second == 0) genotypes(j, iii) =arma::datum::nan;
-          j++;
-        }
-      }
-    } else {
-      for (jj = 0; jj < keepbytes.n_elem; jj++) {
-        b = ch[keepbytes[jj]];
-
-        int c = keepoffset[jj];
-        int first = b[c++];
-        int second = b[c];
-        if (first == 0) {
-          genotypes(j, iii) = (2 - second);
-        }
-        if(fillmissing == 0 && first == 1 && second == 0) genotypes(j, iii) =arma::datum::nan;
-        j++;
-      }
-    }
-    i++;
-	iii++;
-  }
-  return genotypes;
+  return readGenotypes(fileName, N, P, col_skip_pos, col_skip, keepbytes, keepoffset,
+                       fillmissing, NULL);
 }
 
 
@@ -680,17 +507,7 @@ arma::mat genotypeMatrix(const std::string fileName, int N, int P,
 // [[Rcpp::export]]
 arma::vec normalize(arma::mat &genotypes)
 {
-	int k = genotypes.n_cols;
-	int n = genotypes.n_rows;
-	arma::vec sd(k);
-	for (int i = 0; i < k; ++i) {
-		double m = arma::mean(genotypes.col(i));
-		arma::vec mm(n); mm.fill(m);
-		sd(i) = arma::stddev(genotypes.col(i));
-		// sd(i) = 1.0;
-		genotypes.col(i) = arma::normalise(genotypes.col(i) - mm);
-	}
-	return sd;
+  return normalizeColumns(genotypes);
 }
 
 
@@ -771,7 +588,12 @@ arma::vec sd_MultiplePhenotypes(const arma::vec& sd, int q){
 
 //' Runs elnet with various parameters
 //'
+//' The options are those of the runElnet of the mixed model but for anderson, gaptol,
+//' fistasize, ldcache and ldprecision: the objective of the linear model is not convex,
+//' so that it has no duality gap and is never solved by FISTA (see checkConvexity).
+//'
 //' @param lambda1 a vector of lambdas (lambda2 is 0)
+//' @param shrinks a vector of shrinks, each solved for every lambda
 //' @param fileName the file name of the reference panel
 //' @param cor a matrix of correlations, rows represent phenotypes, and columns represent SNPs
 //' @param Inv_Sigma the inverse of the variance-covariance matrix of Y
@@ -786,7 +608,40 @@ arma::vec sd_MultiplePhenotypes(const arma::vec& sd, int q){
 //' @param trace if >1 displays the current iteration
 //' @param maxiter maximal number of iterations
 //' @param Constant a constant to multiply the standardized genotype matrix
-//' @return a list of results
+//' @param nthreads number of threads used to solve the blocks in parallel
+//' @param scheme update scheme of elnet (see elnet)
+//' @param engine solver of the blocks: 0 coordinate descent (elnet), 3 coordinate descent
+//' on the columns of the LD matrix of the block, computed as the SNPs enter the model and
+//' cached (see ldColumnsProblem). 1 and 2, FISTA, are an error
+//' @param joint joint update of the betas of a SNP in elnet
+//' @param sparse if true, beta is returned as a sparse matrix
+//' @param keeppred if false, pred is returned empty (see multiBed3spInput to compute it
+//' from beta)
+//' @param maf the SNPs of minor allele frequency below maf are left out (their betas are 0)
+//' @param callrate the SNPs of call rate below callrate are left out
+//' @param lowrank if > 0, the blocks solved by elnet are solved on a low-rank factor of
+//' their genotypes which accounts for this fraction of their variance (see lowrankFactors)
+//' @param windowend if not empty, the last SNP (0-based, over every SNP) within the window
+//' of each SNP: the SNPs are then solved without blocks, on their LD matrix restricted to
+//' these windows (see bandProblem)
+//' @param ldthr the correlations below ldthr in absolute value are dropped from this matrix
+//' @param single if true, the genotypes are read and standardized in single precision, and
+//' the blocks solved on them by coordinate descent with single-precision cross products
+//' (see floatBlocks); engine, scheme, joint, lowrank and windowend are then not used
+//' @param polish with single, the solution of each block is polished by coordinate descent
+//' with double-precision cross products
+//' @param ldmemory with engine 3, the size in bytes of the caches of LD columns
+//' @param shotgun if > 0, the blocks of at least shotgun SNPs are solved one after the
+//' other, each with the nthreads threads, by coordinate descent on batches of SNPs in
+//' weak LD updated at once (see shotgunProblem). Their betas do not depend on nthreads
+//' @param shotgunwindow the SNPs of a batch are in weak LD with the shotgunwindow SNPs
+//' after them
+//' @param shotgunthr the correlation, in absolute value, from which two SNPs are in strong LD
+//' @param stream if true, the blocks are read, standardized and solved one after the
+//' other, the next one being read while the current one is solved (see streamElnet); the
+//' blocks must then be made of whole SNPs and cover all the SNPs in order. nthreads is
+//' then only used within a block, and windowend and single are not used
+//' @return a list with the results of each shrink
 //' @keywords internal
 //'
 
@@ -796,109 +651,148 @@ arma::vec sd_MultiplePhenotypes(const arma::vec& sd, int q){
 // Je n'ai pas encore modifié l'expression de fbeta et loss !
 
 
-List runElnet(arma::vec& lambda, double shrink, const std::string fileName,
+List runElnet(arma::vec& lambda, arma::vec& shrinks, const std::string fileName,
               arma::mat& cor, arma ::mat& Inv_Sigma ,int N, int P,
               arma::Col<int>& col_skip_pos, arma::Col<int>& col_skip,
               arma::Col<int>& keepbytes, arma::Col<int>& keepoffset,
               double thr, arma::mat& init, int trace, int maxiter,
-              arma::Col<int>& startvec, arma::Col<int>& endvec) {
-  // a) read bed file
-  // b) standardize genotype matrix
-  // c) multiply by constatant factor
-  // d) perfrom elnet
-
-  // Rcout << "ABC" << std::endl;
-
-  int i,j;
-
-  arma::mat genotypes_one_phenotype = genotypeMatrix(fileName, N, P, col_skip_pos, col_skip, keepbytes,
-                                       keepoffset, 1);
-
-  // On commence par normaliser la matrice génotype pour un seul phénotype
-
-  arma::vec sd = normalize(genotypes_one_phenotype);
-  // On construit le vecteur sd pour plusieurs phenotypes
-  arma::vec sd_MultiplePheno = sd_MultiplePhenotypes(sd,Inv_Sigma.n_cols);
-
-  genotypes_one_phenotype *= sqrt(1.0 - shrink);
-
-  // Ensuite on construit la matrice pour plusieurs phénotypes
-
-  arma::mat genotypes = GenotypeMatrixMultiplePhenotypes(genotypes_one_phenotype,Inv_Sigma.n_cols);
-
-  // Rcout << "DEF" << std::endl;
-
-  // Ici, je transforme cor et init en des vecteurs pour pouvoir travailler avec :
-
-  arma::vec r(cor.n_rows*cor.n_cols,arma::fill::zeros);
-  int b = 0;
-  for(int a=0; a < r.n_elem; a+=cor.n_rows) {
-    r.subvec(a,a+cor.n_rows-1) = cor.col(b);
-    b=b+1;
-    }
-
-  arma::vec x(init.n_rows*init.n_cols,arma::fill::zeros);
-  int q = 0;
-  for(int e=0; e < x.n_elem; e+=init.n_rows) {
-    x.subvec(e,e+init.n_rows-1) = init.col(q);
-    q=q+1;
-  }
-
-  if (genotypes.n_cols != r.n_elem) {
-    throw std::runtime_error("Number of positions in reference file is not "
-                               "equal the number of regression coefficients");
-  }
-
-
-  arma::Col<int> conv(lambda.n_elem);
-  int len = r.n_elem;
-
-  arma::mat beta(len, lambda.n_elem);
-  arma::mat pred(genotypes.n_rows, lambda.n_elem); pred.zeros();
-  arma::vec out(lambda.n_elem);
-  arma::vec loss(lambda.n_elem);
-  arma::vec diag(r.n_elem); diag.fill(1.0 - shrink);
-  // Rcout << "HIJ" << std::endl;
+              arma::Col<int>& startvec, arma::Col<int>& endvec,
+              int nthreads=1, int scheme=0, int engine=0, bool joint=false,
+              bool sparse=false, bool keeppred=true,
+              double maf=0.0, double callrate=0.0, double lowrank=0.0,
+              IntegerVector windowend=IntegerVector::create(), double ldthr=0.0,
+              bool single=false, bool polish=true, double ldmemory=4e9, int shotgun=0,
+              int shotgunwindow=200, double shotgunthr=0.1, bool stream=false) {
+  ElnetOptions opt;
+  opt.nthreads = nthreads;
+  opt.scheme = scheme;
+  opt.engine = engine;
+  opt.joint = joint;
+  opt.sparse = sparse;
+  opt.keeppred = keeppred;
+  opt.maf = maf;
+  opt.callrate = callrate;
+  opt.lowrank = lowrank;
+  opt.windowend = as<arma::Col<int> >(windowend);
+  opt.ldthr = ldthr;
+  opt.single = single;
+  opt.polish = polish;
+  opt.ldmemory = ldmemory;
+  opt.shotgun = shotgun;
+  opt.shotgunwindow = shotgunwindow;
+  opt.shotgunthr = shotgunthr;
+  return runElnetCore(LinearModel(Inv_Sigma), lambda, shrinks, fileName, cor, N, P,
+                      col_skip_pos, col_skip, keepbytes, keepoffset, thr, init, trace, maxiter,
+                      startvec, endvec, opt, stream);
+}
 
-  for(j=0; j < diag.n_elem; j++) {
-    if(sd_MultiplePheno(j) == 0.0) diag(j) = 0.0;
-  }
-  // Rcout << "LMN" << std::endl;
-
-  arma::vec fbeta(lambda.n_elem);
-  arma::vec yhat(genotypes.n_rows);
-  // yhat = genotypes * x;
-
-
-  // Rcout << "Starting loop" << std::endl;
-  for (i = 0; i < lambda.n_elem; ++i) {
-    if (trace > 0)
-      Rcout << "lambda: " << lambda(i) << "\n" << std::endl;
-    out(i) =
-      repelnet(lambda(i), shrink, diag,genotypes, r,Inv_Sigma, thr, x, yhat, trace-1, maxiter,
-               startvec, endvec);
-    beta.col(i) = x;
-    for(j=0; j < beta.n_rows; j++) {
-      if(sd_MultiplePheno(j) == 0.0) beta(j,i)=beta(j,i) * shrink;
-    }
+//' Runs elnet for several problems on the same reference panel
+//'
+//' The reference panel is read and standardized once, then each problem (a set of
+//' traits with its correlations, variance matrix, initial betas and blocks) is
+//' solved as by runElnet. With nthreads > 1 and several problems, the problems are
+//' solved in parallel, each on one thread, rather than their blocks.
+//'
+//' @param cor a list of matrices of correlations, one per problem (see runElnet)
+//' @param Inv_Sigma a list of inverses of the variance-covariance matrix of Y
+//' @param init a list of numeric matrices of beta coefficients
+//' @param startvec a list of the first column of each block, for each problem
+//' @param endvec a list of the last column of each block, for each problem
+//' @param engine see runElnet
+//' @param joint see runElnet
+//' @param maf see runElnet
+//' @param callrate see runElnet
+//' @param lowrank see runElnet
+//' @param windowend see runElnet
+//' @param ldthr see runElnet
+//' @param ldmemory see runElnet
+//' @param shotgun see runElnet; the blocks are solved with several threads only when
+//' there is one problem
+//' @param shotgunwindow see runElnet
+//' @param shotgunthr see runElnet
+//' @return a list with the results of each problem, as returned by runElnet
+//' @keywords internal
+//'
 
-    if (out(i) != 1) {
-       throw std::runtime_error("Not converging.....");
-    }
+// [[Rcpp::export]]
+List runElnetBatch(arma::vec& lambda, arma::vec& shrinks, const std::string fileName,
+                   List cor, List Inv_Sigma, int N, int P,
+                   arma::Col<int>& col_skip_pos, arma::Col<int>& col_skip,
+                   arma::Col<int>& keepbytes, arma::Col<int>& keepoffset,
+                   double thr, List init, int trace, int maxiter,
+                   List startvec, List endvec,
+                   int nthreads=1, int scheme=0, int engine=0, bool joint=false,
+                   bool sparse=false, bool keeppred=true,
+                   double maf=0.0, double callrate=0.0, double lowrank=0.0,
+                   IntegerVector windowend=IntegerVector::create(), double ldthr=0.0,
+                   double ldmemory=4e9, int shotgun=0, int shotgunwindow=200,
+                   double shotgunthr=0.1) {
+  ElnetOptions opt;
+  opt.nthreads = nthreads;
+  opt.scheme = scheme;
+  opt.engine = engine;
+  opt.joint = joint;
+  opt.sparse = sparse;
+  opt.keeppred = keeppred;
+  opt.maf = maf;
+  opt.callrate = callrate;
+  opt.lowrank = lowrank;
+  opt.windowend = as<arma::Col<int> >(windowend);
+  opt.ldthr = ldthr;
+  opt.ldmemory = ldmemory;
+  opt.shotgun = shotgun;
+  opt.shotgunwindow = shotgunwindow;
+  opt.shotgunthr = shotgunthr;
+  std::vector<LinearModel> models;
+  for(int t=0; t < Inv_Sigma.size(); t++)
+    models.push_back(LinearModel(as<arma::mat>(Inv_Sigma[t])));
+  return runElnetBatchCore(models, lambda, shrinks, fileName, cor, N, P, col_skip_pos, col_skip,
+                           keepbytes, keepoffset, thr, init, trace, maxiter, startvec, endvec,
+                           opt);
+}
 
+//' Runs elnet on the chunks of the blocks on a pool of threads
+//'
+//' The chunks, groups of consecutive blocks, are read, standardized and solved as
+//' problems of their own, as by runElnet with stream, on nthreads worker threads
+//' sharing the inputs, rather than in as many R processes each with its own copy.
+//' The paths of the chunks are merged into those of all the SNPs as with stream.
+//' With nthreads > 1 and several chunks, each chunk is solved on one thread;
+//' otherwise the blocks of each chunk are solved on nthreads threads.
+//'
+//' @param chunks the chunk of each block, in increasing order
+//' @param ldmemory see runElnet; the chunks solved at once share it
+//' @return a list with the results of each shrink, as returned by runElnet
+//' @keywords internal
+//'
 
-    pred.col(i) = yhat;
-    loss(i) = arma::as_scalar(arma::sum(arma::pow(yhat, 2)) -
-      2.0 * arma::sum(x % r));
-    fbeta(i) =
-      arma::as_scalar(loss(i) + 2.0 * arma::sum(arma::abs(x)) * lambda(i) +
-      arma::sum(arma::pow(x, 2)) * shrink);
-  }
-  return List::create(Named("lambda") = lambda,
-                      Named("beta") = beta,
-                      Named("conv") = out,
-                      Named("pred") = pred,
-                      Named("loss") = loss,
-                      Named("fbeta") = fbeta,
-                      Named("sd")= sd);
+// [[Rcpp::export]]
+List runElnetChunks(arma::vec& lambda, arma::vec& shrinks, const std::string fileName,
+                    arma::mat& cor, arma::mat& Inv_Sigma, int N, int P,
+                    arma::Col<int>& col_skip_pos, arma::Col<int>& col_skip,
+                    arma::Col<int>& keepbytes, arma::Col<int>& keepoffset,
+                    double thr, arma::mat& init, int trace, int maxiter,
+                    arma::Col<int>& startvec, arma::Col<int>& endvec, arma::Col<int>& chunks,
+                    int nthreads=1, int scheme=0, int engine=0, bool joint=false,
+                    bool sparse=false, bool keeppred=true,
+                    double maf=0.0, double callrate=0.0, double lowrank=0.0,
+                    double ldmemory=4e9, int shotgun=0, int shotgunwindow=200,
+                    double shotgunthr=0.1) {
+  ElnetOptions opt;
+  opt.nthreads = nthreads;
+  opt.scheme = scheme;
+  opt.engine = engine;
+  opt.joint = joint;
+  opt.sparse = sparse;
+  opt.keeppred = keeppred;
+  opt.maf = maf;
+  opt.callrate = callrate;
+  opt.lowrank = lowrank;
+  opt.ldmemory = ldmemory;
+  opt.shotgun = shotgun;
+  opt.shotgunwindow = shotgunwindow;
+  opt.shotgunthr = shotgunthr;
+  return runElnetChunksCore(LinearModel(Inv_Sigma), lambda, shrinks, fileName, cor, N, P,
+                            col_skip_pos, col_skip, keepbytes, keepoffset, thr, init, trace,
+                            maxiter, startvec, endvec, chunks, opt);
 }
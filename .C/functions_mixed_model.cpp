@@ -18,104 +18,23 @@
 #include <algorithm>
 #include <iostream>
 #include <cmath>
+#include <chrono>
+#include <thread>
+#include <exception>
 #include <RcppArmadillo.h>
+#include "block_scheduler.h"
+#include "elnet_workspace.h"
+#include "elnet_gap.h"
+#include "elnet_core.h"
+#include "elnet_band.h"
+#include "ld_blocks.h"
+#include "plink_bed.h"
+#include "elnet_path.h"
 
 // [[Rcpp::depends(RcppArmadillo)]]
+// [[Rcpp::plugins(cpp11)]]
 using namespace Rcpp;
 
-/**
- Opens a Plink binary files
-
- @s file name
- @BIT ifstream
- @return is plink file in major mode
-
- */
-
-bool openPlinkBinaryFile(const std::string s, std::ifstream &BIT) {
-  BIT.open(s.c_str(), std::ios::in | std::ios::binary);
-  if (!BIT.is_open()) {
-    throw "Cannot open the bed file";
-  }
-
-  // 2) else check for 0.99 SNP/Ind coding
-  // 3) else print warning that file is too old
-  char ch[1];
-  BIT.read(ch, 1);
-  std::bitset<8> b;
-  b = ch[0];
-  bool bfile_SNP_major = false;
-  bool v1_bfile = true;
-  // If v1.00 file format
-  // Magic numbers for .bed file: 00110110 11011000 = v1.00 bed file
-  // std::cerr << "check magic number" << std::endl;
-  if ((b[2] && b[3] && b[5] && b[6]) && !(b[0] || b[1] || b[4] || b[7])) {
-    // Next number
-    BIT.read(ch, 1);
-    b = ch[0];
-    if ((b[0] && b[1] && b[3] && b[4]) && !(b[2] || b[5] || b[6] || b[7])) {
-      // Read SNP/Ind major coding
-      BIT.read(ch, 1);
-      b = ch[0];
-      if (b[0])
-        bfile_SNP_major = true;
-      else
-        bfile_SNP_major = false;
-
-      // if (bfile_SNP_major) std::cerr << "Detected that binary PED file is
-      // v1.00 SNP-major mode" << std::endl;
-      // else std::cerr << "Detected that binary PED file is v1.00
-      // individual-major mode" << std::endl;
-
-    } else
-      v1_bfile = false;
-
-  } else
-    v1_bfile = false;
-  // Reset file if < v1
-  if (!v1_bfile) {
-    Rcerr << "Warning, old BED file <v1.00 : will try to recover..."
-          << std::endl;
-    Rcerr << "  but you should --make-bed from PED )" << std::endl;
-    BIT.close();
-    BIT.clear();
-    BIT.open(s.c_str(), std::ios::in | std::ios::binary);
-    BIT.read(ch, 1);
-    b = ch[0];
-  }
-  // If 0.99 file format
-  if ((!v1_bfile) && (b[1] || b[2] || b[3] || b[4] || b[5] || b[6] || b[7])) {
-    Rcerr << std::endl
-          << " *** Possible problem: guessing that BED is < v0.99      *** "
-          << std::endl;
-    Rcerr << " *** High chance of data corruption, spurious results    *** "
-          << std::endl;
-    Rcerr
-      << " *** Unless you are _sure_ this really is an old BED file *** "
-      << std::endl;
-    Rcerr << " *** you should recreate PED -> BED                      *** "
-          << std::endl
-          << std::endl;
-    bfile_SNP_major = false;
-    BIT.close();
-    BIT.clear();
-    BIT.open(s.c_str(), std::ios::in | std::ios::binary);
-  } else if (!v1_bfile) {
-    if (b[0])
-      bfile_SNP_major = true;
-    else
-      bfile_SNP_major = false;
-    Rcerr << "Binary PED file is v0.99" << std::endl;
-    if (bfile_SNP_major)
-      Rcerr << "Detected that binary PED file is in SNP-major mode"
-            << std::endl;
-      else
-        Rcerr << "Detected that binary PED file is in individual-major mode"
-              << std::endl;
-  }
-  return bfile_SNP_major;
-}
-
 //' Count number of lines in a text file
 //'
 //' @param fileName Name of file
@@ -388,6 +307,156 @@ arma::mat multiBed3sp(const std::string fileName, int N, int P,
 }
 
 
+//' Converts sparse betas to the input of multiBed3sp
+//'
+//' @param beta the betas, a (p*q) x nlambda sparse matrix (see runElnet)
+//' @param q number of phenotypes
+//' @return a list with the arguments beta, nonzeros, colpos and ncol of multiBed3sp:
+//' the nonzero betas SNP by SNP, their number for each SNP, and their column in the
+//' result, l*q+k for trait k and lambda l (0-based)
+//' @keywords internal
+//'
+// [[Rcpp::export]]
+List multiBed3spInput(const arma::sp_mat& beta, int q) {
+  return sparseBetaInput(beta, q);
+}
+
+
+// Whether the off-diagonal elements of A are all zero
+
+static bool isDiagonal(const arma::mat& A)
+{
+  for(int k=0; k < A.n_rows; k++)
+    for(int h=0; h < A.n_cols; h++)
+      if(h != k && A(k,h) != 0.0) return false;
+  return true;
+}
+
+
+// The mixed model, for the solver of elnet_core.h. The update of x(q*j+k) has
+// t1 = -0.5*sum_{h != k} inv_Sb(k,h)*x(q*j+h), t2 = sum_h inv_Ss(k,h)*r(q*j+h),
+// t3 = -inv_Ss(k,k)*S and the denominator inv_Ss(k,k)*denom + inv_Sb(k,k).
+//
+// The updates are a coordinate descent of 0.5*x'Hx - x'b + lambda1*sum(abs(x)),
+// for the betas x and yhat = X*x, where b(q*j+k) is t2, H has
+// inv_Ss(k,k)*t(X[,q*j+k])*X[,q*l+k] between SNPs j != l (t3), 0.5*inv_Sb(k,h)
+// between the traits of a SNP (t1), and the denominator of the update on its
+// diagonal. H = L'L + I_p (x) P, where L is X whose rows of trait k are
+// multiplied by sqrt(inv_Ss(k,k)) and P holds inv_Sb and lambda2, so that the
+// objective is convex and has a duality gap (see elnet_gap.h).
+//
+// For the paths of elnet_path.h, loss is yhat'inv_Se yhat - 2*x'inv_Ss_pq r and
+// fbeta adds lambda2*x'inv_Ss_pq x + x'inv_B x to its penalty, with
+// inv_Se = kron(I_n, inv_Ss), inv_Ss_pq = kron(I_p, inv_Ss) and
+// inv_B = kron(I_p, inv_Sb). The traits are separable when inv_Sb and inv_Ss
+// are both diagonal.
+
+struct MixedModel {
+  arma::mat inv_Sb;
+  arma::mat inv_Ss;
+  bool diagSs; // t2 is then simply inv_Ss(k,k)*r(q*j+k)
+  static const bool snpSd = false;
+
+  MixedModel(const arma::mat& inv_Sb, const arma::mat& inv_Ss) :
+    inv_Sb(inv_Sb), inv_Ss(inv_Ss), diagSs(isDiagonal(inv_Ss)) {}
+
+  int q() const { return inv_Sb.n_cols; }
+
+  double t1(int q, int k, const double* xj, double denom) const {
+    double t1 = 0.0;
+    for(int h=0; h < q; h++) {
+      if(h != k) t1 = t1 + inv_Sb.at(k,h)*xj[h];
+    }
+    // Rmq quand j'écrivais (-1/2)*t1, on me donnais t1=0 car il considère
+    // 1/2 comme 0 ( divison entière )
+    return -(0.5)*t1;
+  }
+
+  double t2(int q, int k, const double* rj) const {
+    if(diagSs) return inv_Ss.at(k,k)*rj[k];
+    double t2 = 0.0;
+    for(int h=0; h < q; h++) t2 = t2 + inv_Ss.at(k,h)*rj[h];
+    return t2;
+  }
+
+  double t3(int k, double S) const { return -1*(inv_Ss.at(k,k))*S; }
+
+  double denominator(int k, double denom) const {
+    return inv_Ss.at(k,k)*denom + inv_Sb.at(k,k);
+  }
+
+  double objective(double lambda1, double lambda2, const arma::vec& diag, const arma::vec& r,
+                   const arma::vec& x, const arma::vec& yhat) const {
+    int q = inv_Sb.n_cols;
+    int p = x.n_elem / q;
+    int n = yhat.n_elem / q;
+    double quad = 0.0, lin = 0.0, l1 = 0.0;
+    int i, j, k, h;
+
+    // Rows q*i+k of X are those of trait k, so that sum_i yhat(q*i+k)^2 is
+    // the quadratic form of trait k over all SNPs, diagonal included
+    for(k=0; k < q; k++) {
+      double yy = 0.0;
+      for(i=0; i < n; i++) yy += yhat.at(q*i+k) * yhat.at(q*i+k);
+      quad += inv_Ss.at(k,k) * yy;
+    }
+    for(j=0; j < p; j++) {
+      for(k=0; k < q; k++) {
+        double xc = x.at(q*j+k);
+        if(xc == 0.0) continue;
+        quad += (inv_Ss.at(k,k) * lambda2 + inv_Sb.at(k,k)) * xc * xc;
+        for(h=0; h < q; h++) {
+          if(h != k) quad += 0.5 * inv_Sb.at(k,h) * xc * x.at(q*j+h);
+          lin += inv_Ss.at(k,h) * r.at(q*j+h) * xc;
+        }
+        l1 += std::abs(xc);
+      }
+    }
+    return 0.5 * quad - lin + lambda1 * l1;
+  }
+
+  bool gap(int q, double lambda2, arma::vec& D, arma::mat& P) const {
+    D.set_size(q);
+    P.set_size(q, q);
+    for(int k=0; k < q; k++) {
+      D.at(k) = inv_Ss.at(k,k);
+      for(int h=0; h < q; h++)
+        P.at(k,h) = (h == k) ? inv_Ss.at(k,k)*lambda2 + inv_Sb.at(k,k) : 0.5*inv_Sb.at(k,h);
+    }
+    return true;
+  }
+
+  bool convex() const { return true; }
+
+  bool separable() const { return isDiagonal(inv_Sb) && isDiagonal(inv_Ss); }
+
+  MixedModel trait(int k) const {
+    arma::mat Sb(1, 1), Ss(1, 1);
+    Sb(0,0) = inv_Sb(k,k);
+    Ss(0,0) = inv_Ss(k,k);
+    return MixedModel(Sb, Ss);
+  }
+
+  arma::mat lossWeights(const arma::mat& R) const { return inv_Ss * R; }
+
+  // Les formes quadratiques sur les vues q x n de yhat et q x p des betas
+  double fittedQuad(const double* yhat, int n, arma::mat& s) const {
+    arma::mat yhatq(const_cast<double*>(yhat), inv_Ss.n_cols, n, false, true);
+    s = inv_Ss * yhatq;
+    return arma::accu(yhatq % s);
+  }
+
+  double ldQuad(const arma::mat& xb, const arma::mat& R) const {
+    return arma::accu((inv_Ss * xb * R) % xb);
+  }
+
+  double betaQuad(const arma::mat& xq, double lambda2, arma::mat& s1, arma::mat& s2) const {
+    s1 = inv_Ss * xq;
+    s2 = inv_Sb * xq;
+    return lambda2 * arma::accu(xq % s1) + arma::accu(xq % s2);
+  }
+};
+
 
 //' Performs elnet
 //'
@@ -402,170 +471,57 @@ arma::mat multiBed3sp(const std::string fileName, int N, int P,
 //' @param yhat a vector
 //' @param trace if >1 displays the current iteration
 //' @param maxiter maximal number of iterations
+//' @param scheme update scheme: 0 Jacobi, 1 cyclic Gauss-Seidel, 2 Gauss-Seidel
+//' in a random order, 3 Gauss-Seidel in greedy (largest change first) order
+//' @param anderson if > 0, every anderson+1 sweeps the betas are extrapolated from
+//' the last anderson+1 sweeps (Anderson acceleration), keeping the extrapolation
+//' only if it decreases the objective
+//' @param gaptol if > 0, elnet stops once the duality gap is below gaptol times the
+//' objective instead of once the betas change by less than thr, and leaves out the
+//' betas proven to be zero by the gap (safe screening)
+//' @param joint if true, the q betas of a SNP are updated jointly, solving their q x q
+//' subproblem, with one pass over the SNP's genotypes instead of one per trait
 //' @return conv
 //' @keywords internal
 //'
 // [[Rcpp::export]]
-
 int elnet(double lambda1, double lambda2, const arma::vec& diag, const arma::mat& X,
-          const arma::vec& r, const arma ::mat& inv_Sb,const arma ::mat& inv_Ss ,double thr, arma::vec& x, arma::vec& yhat, int trace, int maxiter)
+          const arma::vec& r, const arma ::mat& inv_Sb,const arma ::mat& inv_Ss ,double thr, arma::vec& x, arma::vec& yhat, int trace, int maxiter,
+          int scheme=1, int anderson=0, double gaptol=0.0, bool joint=false)
 {
-
-
-  // diag is basically diag(X'X)
-  // Also, ensure that the yhat=X*x in the input. Usually, both x and yhat are preset to 0.
-  // They are modified in place in this function.
-
-
-  int nq =X.n_rows;
-  int pq =X.n_cols;
-  int q = inv_Sb.n_cols;
-  int p = (pq)/(q);
-
-
   // avant je comparais r.n_elem avec pq, mais on me donnait warning, donc je compare directement
   // r.n_elem avec X.n_cols, pareil pour les autres
   if(r.n_elem != X.n_cols) stop("r.n_elem != X.n_cols");
   if(x.n_elem != X.n_cols) stop("x.n_elem != X.n_cols");
   if(yhat.n_elem != X.n_rows) stop("yhat.n_elem != X.n_rows");
   if(diag.n_elem != X.n_cols) stop("diag.n_elem != X.n_cols");
-
-  double dlx,del,t1,t2,t3, A,S ;
-
-  // j : indice des SNPs, k : indice des traits, m: indice des itérations, u indice pour parcourir le vecteur x ( des betas ),
-  // h indice utilisé pour définir t1 , l incide utilisé pour définir t3
-  int j,k,m,u,h,l;
-
-  // On définit le vecteur x_before ( qui contient les valeurs des betas à l'itération t-1 )
-  arma :: vec x_before(pq,arma::fill::zeros);
-
-  arma::vec Lambda2(pq);
-
-  Lambda2.fill(lambda2);
-  arma::vec denom=diag + Lambda2;
-
-  // On définit le vecteur C , on en aura besoin pour le calcul du terme t3, c'est t(Xj)*Xl*Betal, un vecteur
-  // de taille q
-  arma::vec C(q);
-
-  int conv=0;
-
-  for(m=0;m<maxiter ;m++) {
-    dlx=0.0;
-    // Mon beta est x : c'est un vecteur de taille pq : x = ( q betas pour le SNP1 , q betas pour le SNP 2, .., q betas pour le SNP p )
-
-    x_before = x;
-
-    // boucle sur les SNPS :
-    for (j= 0; j<p; j++) {
-
-      // Pour chaque SNP, on fait une boucle sur les traits :
-      for(k=0; k < q; k++) {
-
-        x.at(q*j+k)=0.0;
-
-
-        // On initialise les termes dont on aura besoin : t1, t2 et t3 ( ce sont les 3 composantes de A comme définie dans la partie théorique )
-        // ainsi que A et S
-
-        t1 = 0.0 ;
-        t2 = 0.0 ;
-        t3 = 0.0 ;
-        A = 0.0 ;
-        S = 0.0 ;
-
-        // RMQ : c++ commence à indicer à partir de 0 ( le premier élément d'un vecteur à l'indice 0),
-        // alors que R commence à indicer à partir de 1 ( le premier élément d'un vecteur à l'indice 1 )
-
-        // On définit le terme t1 :
-
-        for (h =0 ; h<q;h++){
-          if (h!=k) t1=t1+ inv_Sb.at(k,h)*x.at(q*j+h);
-        }
-
-        // Rmq quand j'écrivais (-1/2)*t1, on me donnais t1=0 car il considère
-        // 1/2 comme 0 ( divison entière )
-        t1=-(0.5)*t1;
-
-        // On définit le terme t2 :
-
-        t2 = arma::dot(inv_Ss.row(k),r.subvec(q*j,q*(j+1)-1))  ;
-
-        // On définit le terme t3 :
-
-        for(l=0; l< p;l++){
-          C = trans(X.cols(q*j,q*(j+1)-1))*X.cols(q*l,q*(l+1)-1)*x.subvec(q*l,q*(l+1)-1);
-          if(l!=j) S = S + C.at(k);
-        }
-
-
-        t3 = -1*(inv_Ss.at(k,k))*S;
-
-        A=t1+t2+t3;
-
-        // On définit maintenant la solution Beta
-
-        if (A < 0){
-          if (A + lambda1 <=0 ) {
-            x.at(q*j+k) = (A+ lambda1)/(inv_Ss.at(k,k)*denom.at(q*j+k)+inv_Sb.at(k,k));
-          }
-        }
-
-        if (A > 0){
-          if (A - lambda1>= 0){
-            x.at(q*j+k) = (A- lambda1)/(inv_Ss.at(k,k)*denom.at(q*j+k)+inv_Sb.at(k,k));
-          }
-        }
-
-        if (x.at(q*j+k)==x_before.at(q*j+k) ) continue;
-        del = x.at(q*j+k)-x_before.at(q*j+k);
-        dlx=std::max(dlx,std::abs(del));
-
-        yhat += del*X.col(q*j+k);
-      }
-    }
-
-    checkUserInterrupt();
-    if(trace > 0) Rcout << "Iteration: " << m << "\n";
-
-    if(dlx < thr) {
-      conv=1;
-      break;
-    }
-  }
-
-  return conv;
+  if(anderson < 0) stop("anderson < 0");
+  if(gaptol < 0) stop("gaptol < 0");
+
+  ElnetWorkspace ws(X.n_cols, X.n_rows, anderson);
+  ElnetStats stats;
+  return elnetCoreFor<MixedModel>(inv_Sb.n_cols)(MixedModel(inv_Sb, inv_Ss), lambda1, lambda2,
+                                                 diag, X, r, thr, x, yhat, trace, maxiter,
+                                                 ElnetControl(scheme, anderson, gaptol, joint),
+                                                 ws, stats, NULL);
 }
 
 
 // [[Rcpp::export]]
 int repelnet(double lambda1, double lambda2, arma::vec& diag, arma::mat& X, arma::vec& r, arma ::mat& inv_Sb, arma ::mat& inv_Ss,
              double thr, arma::vec& x, arma::vec& yhat, int trace, int maxiter,
-             arma::Col<int>& startvec, arma::Col<int>& endvec)
+             arma::Col<int>& startvec, arma::Col<int>& endvec, int nthreads=1,
+             int scheme=1, int anderson=0, double gaptol=0.0, bool joint=false)
 {
-
-  // Repeatedly call elnet by blocks...
-  int nreps=startvec.n_elem;
-  int out=1;
-  for(int i=0;i < startvec.n_elem; i++) {
-    arma::vec xtouse=x.subvec(startvec(i), endvec(i));
-    arma::vec yhattouse=X.cols(startvec(i), endvec(i)) * xtouse;
-
-    int out2=elnet(lambda1, lambda2,
-                   diag.subvec(startvec(i), endvec(i)),
-                   X.cols(startvec(i), endvec(i)),
-                   r.subvec(startvec(i), endvec(i)),
-                   inv_Sb,inv_Ss,
-                   thr, xtouse,
-                   yhattouse, trace - 1, maxiter);
-    x.subvec(startvec(i), endvec(i))=xtouse;
-    yhat += yhattouse;
-    if(trace > 0) Rcout << "Block: " << i << "\n";
-    out=std::min(out, out2);
-  }
-  return out;
+  std::vector<ElnetWorkspace> ws=elnetWorkspaces(startvec, endvec, X.n_rows, nthreads, anderson);
+  std::vector<ElnetStats> stats(startvec.n_elem);
+  return repelnetCore(MixedModel(inv_Sb, inv_Ss), lambda1, lambda2, diag, X, r, thr, x, yhat,
+                      trace, maxiter, startvec, endvec, nthreads, elnetCoreFor<MixedModel>(inv_Sb.n_cols),
+                      ElnetControl(scheme, anderson, gaptol, joint), ws, stats,
+                      std::vector<char>(startvec.n_elem, 0));
 }
 
+
 //' imports genotypeMatrix
 //'
 //' @param fileName location of bam file
@@ -583,93 +539,8 @@ arma::mat genotypeMatrix(const std::string fileName, int N, int P,
                          arma::Col<int> col_skip_pos, arma::Col<int> col_skip,
                          arma::Col<int> keepbytes, arma::Col<int> keepoffset,
                          const int fillmissing) {
-
-  std::ifstream bedFile;
-  bool snpMajor = openPlinkBinaryFile(fileName, bedFile);
-
-  if (!snpMajor)
-    throw std::runtime_error("We currently have no plans of implementing the "
-                               "individual-major mode. Please use the snp-major "
-                               "format");
-
-  int i = 0;
-  int ii = 0;
-  const bool colskip = (col_skip_pos.n_elem > 0);
-  unsigned long long int Nbytes = ceil(N / 4.0);
-  const bool selectrow = (keepbytes.n_elem > 0);
-  int n, p, nskip;
-  if (selectrow)
-    n = keepbytes.n_elem;
-  else
-    n = N;
-
-  if (colskip) {
-    nskip = arma::accu(col_skip);
-    p = P - nskip;
-  }  else
-    p = P;
-
-  int j, jj, iii;
-
-  arma::mat genotypes = arma::mat(n, p, arma::fill::zeros);
-  std::bitset<8> b; // Initiate the bit array
-  char ch[Nbytes];
-
-  iii=0;
-  while (i < P) {
-    // Rcout << i << std::endl;
-    Rcpp::checkUserInterrupt();
-    if (colskip) {
-      if (ii < col_skip.n_elem) {
-        if (i == col_skip_pos[ii]) {
-          bedFile.seekg(col_skip[ii] * Nbytes, bedFile.cur);
-          i = i + col_skip[ii];
-          ii++;
-          continue;
-        }
-      }
-    }
-
-    bedFile.read(ch, Nbytes); // Read the information
-    if (!bedFile)
-      throw std::runtime_error(
-          "Problem with the BED file...has the FAM/BIM file been changed?");
-
-    j = 0;
-    if (!selectrow) {
-      for (jj = 0; jj < Nbytes; jj++) {
-        b = ch[jj];
-
-        int c = 0;
-        while (c < 7 &&
-               j < N) { // from the original PLINK: 7 because of 8 bits
-          int first = b[c++];
-          int second = b[c++];
-          if (first == 0) {
-            genotypes(j, iii) = (2 - second);
-          }
-          if(fillmissing == 0 && first == 1 && second == 0) genotypes(j, iii) =arma::datum::nan;
-          j++;
-        }
-      }
-    } else {
-      for (jj = 0; jj < keepbytes.n_elem; jj++) {
-        b = ch[keepbytes[jj]];
-
-        int c = keepoffset[jj];
-        int first = b[c++];
-        int second = b[c];
-        if (first == 0) {
-          genotypes(j, iii) = (2 - second);
-        }
-        if(fillmissing == 0 && first == 1 && second == 0) genotypes(j, iii) =arma::datum::nan;
-        j++;
-      }
-    }
-    i++;
-    iii++;
-  }
-  return genotypes;
+  return readGenotypes(fileName, N, P, col_skip_pos, col_skip, keepbytes, keepoffset,
+                       fillmissing, NULL);
 }
 
 
@@ -682,17 +553,7 @@ arma::mat genotypeMatrix(const std::string fileName, int N, int P,
 // [[Rcpp::export]]
 arma::vec normalize(arma::mat &genotypes)
 {
-  int k = genotypes.n_cols;
-  int n = genotypes.n_rows;
-  arma::vec sd(k);
-  for (int i = 0; i < k; ++i) {
-    double m = arma::mean(genotypes.col(i));
-    arma::vec mm(n); mm.fill(m);
-    sd(i) = arma::stddev(genotypes.col(i));
-    // sd(i) = 1.0;
-    genotypes.col(i) = arma::normalise(genotypes.col(i) - mm);
-  }
-  return sd;
+  return normalizeColumns(genotypes);
 }
 
 
@@ -774,6 +635,7 @@ arma::vec sd_MultiplePhenotypes(const arma::vec& sd, int q){
 //' Runs elnet with various parameters
 //'
 //' @param lambda1 a vector of lambdas (lambda2 is 0)
+//' @param shrinks a vector of shrinks, each solved for every lambda
 //' @param fileName the file name of the reference panel
 //' @param cor a matrix of correlations, rows represent phenotypes, and columns represent SNPs
 //' @param inv_Sb the inverse of the variance-covariance matrix of genetic effects
@@ -789,7 +651,57 @@ arma::vec sd_MultiplePhenotypes(const arma::vec& sd, int q){
 //' @param trace if >1 displays the current iteration
 //' @param maxiter maximal number of iterations
 //' @param Constant a constant to multiply the standardized genotype matrix
-//' @return a list of results
+//' @param nthreads number of threads used to solve the blocks in parallel
+//' @param scheme update scheme of elnet (see elnet)
+//' @param anderson Anderson acceleration of elnet (see elnet)
+//' @param gaptol duality gap stopping criterion of elnet (see elnet)
+//' @param engine solver of the blocks: 0 coordinate descent (elnet), 1 accelerated
+//' proximal gradient (FISTA) on the LD matrix of the block, for all lambdas at once,
+//' 2 FISTA for the blocks of at least fistasize SNPs, no more SNPs than subjects and an LD
+//' matrix of at most ldmemory/nthreads bytes, and elnet for the others, 3 coordinate
+//' descent on the columns of the LD matrix of the block, computed as the SNPs enter the
+//' model and cached (see ldColumnsProblem). FISTA
+//' stops once the duality gap is below gaptol (1e-8 if gaptol is 0) times the objective
+//' @param fistasize see engine
+//' @param joint joint update of the betas of a SNP in elnet (see elnet)
+//' @param sparse if true, beta is returned as a sparse matrix
+//' @param keeppred if false, pred is returned empty (see multiBed3spInput to compute it
+//' from beta)
+//' @param maf the SNPs of minor allele frequency below maf are left out (their betas are 0)
+//' @param callrate the SNPs of call rate below callrate are left out
+//' @param lowrank if > 0, the blocks solved by elnet are solved on a low-rank factor of
+//' their genotypes which accounts for this fraction of their variance (see lowrankFactors)
+//' @param windowend if not empty, the last SNP (0-based, over every SNP) within the window
+//' of each SNP: the SNPs are then solved without blocks, on their LD matrix restricted to
+//' these windows (see bandProblem)
+//' @param ldthr the correlations below ldthr in absolute value are dropped from this matrix
+//' @param ldcache if not empty, an LD cache file (see ld_cache.h): if it was written for the
+//' same .bed file, selection and blocks, the genotypes are not read and every block is solved
+//' by FISTA on its LD matrix in the cache (pred is then empty, and loss computed from the LD
+//' of the blocks); otherwise it is written. Not used with lowrank or windowend, nor if a
+//' block has more SNPs than subjects or an LD matrix of more than ldmemory/nthreads bytes
+//' @param ldprecision the precision of the LD matrices written to the cache: 0 float, 1 16-bit
+//' integers
+//' @param single if true, the genotypes are read and standardized in single precision, and
+//' the blocks solved on them by coordinate descent with single-precision cross products
+//' (see floatBlocks); engine, scheme, anderson, gaptol, joint, lowrank, windowend and
+//' ldcache are then not used
+//' @param polish with single, the solution of each block is polished by coordinate descent
+//' with double-precision cross products
+//' @param ldmemory with engine 3, the size in bytes of the caches of LD columns
+//' @param shotgun if > 0, the blocks of at least shotgun SNPs are solved one after the
+//' other, each with the nthreads threads, by coordinate descent on batches of SNPs in
+//' weak LD updated at once (see shotgunProblem), rather than by FISTA or elnet. Their
+//' betas do not depend on nthreads
+//' @param shotgunwindow the SNPs of a batch are in weak LD with the shotgunwindow SNPs
+//' after them
+//' @param shotgunthr the correlation, in absolute value, from which two SNPs are in strong LD
+//' @param stream if true, the blocks are read, standardized and solved one after the
+//' other, the next one being read while the current one is solved, so that only the
+//' genotypes of two blocks are in memory (see streamElnet); the blocks must then be made
+//' of whole SNPs and cover all the SNPs in order. nthreads is then only used within a
+//' block, and windowend, ldcache and single are not used
+//' @return a list with the results of each shrink
 //' @keywords internal
 //'
 
@@ -797,1030 +709,211 @@ arma::vec sd_MultiplePhenotypes(const arma::vec& sd, int q){
 
 
 
-List runElnet(arma::vec& lambda, double shrink, const std::string fileName,
+List runElnet(arma::vec& lambda, arma::vec& shrinks, const std::string fileName,
               arma::mat& cor, arma ::mat& inv_Sb ,arma ::mat& inv_Ss,int N, int P,
               arma::Col<int>& col_skip_pos, arma::Col<int>& col_skip,
               arma::Col<int>& keepbytes, arma::Col<int>& keepoffset,
               double thr, arma::mat& init, int trace, int maxiter,
-              arma::Col<int>& startvec, arma::Col<int>& endvec) {
-  // a) read bed file
-  // b) standardize genotype matrix
-  // c) multiply by constatant factor
-  // d) perfrom elnet
-
-  // Rcout << "ABC" << std::endl;
-
-  int i,j;
-
-  arma::mat genotypes_one_phenotype = genotypeMatrix(fileName, N, P, col_skip_pos, col_skip, keepbytes,
-                                                     keepoffset, 1);
-
-  // On commence par normaliser la matrice génotype pour un seul phénotype
-
-  arma::vec sd = normalize(genotypes_one_phenotype);
-  // On construit le vecteur sd pour plusieurs phenotypes
-  arma::vec sd_MultiplePheno = sd_MultiplePhenotypes(sd,inv_Sb.n_cols);
-
-  genotypes_one_phenotype *= sqrt(1.0 - shrink);
-
-  // Ensuite on construit la matrice pour plusieurs phénotypes
-
-  arma::mat genotypes = GenotypeMatrixMultiplePhenotypes(genotypes_one_phenotype,inv_Sb.n_cols);
-
-  // Rcout << "DEF" << std::endl;
-
-  // Ici, je transforme cor et init en des vecteurs pour pouvoir travailler avec :
-
-  arma::vec r(cor.n_rows*cor.n_cols,arma::fill::zeros);
-  int b = 0;
-  for(int a=0; a < r.n_elem; a+=cor.n_rows) {
-    r.subvec(a,a+cor.n_rows-1) = cor.col(b);
-    b=b+1;
-  }
-
-  arma::vec x(init.n_rows*init.n_cols,arma::fill::zeros);
-  int q = 0;
-  for(int e=0; e < x.n_elem; e+=init.n_rows) {
-    x.subvec(e,e+init.n_rows-1) = init.col(q);
-    q=q+1;
-  }
-
-  if (genotypes.n_cols != r.n_elem) {
-    throw std::runtime_error("Number of positions in reference file is not "
-                               "equal the number of regression coefficients");
-  }
-
-
-  arma::Col<int> conv(lambda.n_elem);
-  int len = r.n_elem;
-
-  arma::mat beta(len, lambda.n_elem);
-  arma::mat pred(genotypes.n_rows, lambda.n_elem); pred.zeros();
-  arma::vec out(lambda.n_elem);
-  arma::vec loss(lambda.n_elem);
-  arma::vec diag(r.n_elem); diag.fill(1.0 - shrink);
-  // Rcout << "HIJ" << std::endl;
-
-  for(j=0; j < diag.n_elem; j++) {
-    if(sd_MultiplePheno(j) == 0.0) diag(j) = 0.0;
-  }
-  // Rcout << "LMN" << std::endl;
-
-  arma::vec fbeta(lambda.n_elem);
-  arma::vec yhat(genotypes.n_rows);
-  // yhat = genotypes * x;
-
-
-  // Rcout << "Starting loop" << std::endl;
-  for (i = 0; i < lambda.n_elem; ++i) {
-    if (trace > 0)
-      Rcout << "lambda: " << lambda(i) << "\n" << std::endl;
-    out(i) =
-      repelnet(lambda(i), shrink, diag,genotypes, r,inv_Sb,inv_Ss, thr, x, yhat, trace-1, maxiter,
-               startvec, endvec);
-    beta.col(i) = x;
-    for(j=0; j < beta.n_rows; j++) {
-      if(sd_MultiplePheno(j) == 0.0) beta(j,i)=beta(j,i) * shrink;
-    }
-
-    if (out(i) != 1) {
-      throw std::runtime_error("Not converging.....");
-    }
-
-    pred.col(i) = yhat;
-
-    // We calculate inv_B and inv_Se, we need to calculate Loss and fbeta
-
-    arma::mat inv_B = arma::kron(arma::eye(genotypes_one_phenotype.n_cols,genotypes_one_phenotype.n_cols),inv_Sb);
-    arma::mat inv_Se = arma::kron(arma::eye(genotypes_one_phenotype.n_rows,genotypes_one_phenotype.n_rows),inv_Ss);
-
-    // We need the In_Ss matrix in size (pq,pq) for when we calculate the Loss and fbeta
-    arma::mat inv_Ss_pq = arma::kron(arma::eye(genotypes_one_phenotype.n_cols,genotypes_one_phenotype.n_cols),inv_Ss);
-
-    loss(i) = arma::as_scalar(arma::trans(yhat)*inv_Se*yhat - 2.0*(arma::trans(x))*inv_Ss_pq*r);
-
-    fbeta(i) = arma::as_scalar(loss(i) + 2.0 * arma::sum(arma::abs(x)) * lambda(i) +
-      shrink*(arma::trans(x))*inv_Ss_pq*x + (arma::trans(x))*inv_B*x);
-  }
-
-  return List::create(Named("lambda") = lambda,
-                      Named("beta") = beta,
-                      Named("conv") = out,
-                      Named("pred") = pred,
-                      Named("loss") = loss,
-                      Named("fbeta") = fbeta,
-                      Named("sd_MultiplePheno")= sd_MultiplePheno);
+              arma::Col<int>& startvec, arma::Col<int>& endvec,
+              int nthreads=1, int scheme=1, int anderson=0,
+              double gaptol=0.0, int engine=0, int fistasize=1000,
+              bool joint=false, bool sparse=false, bool keeppred=true,
+              double maf=0.0, double callrate=0.0, double lowrank=0.0,
+              IntegerVector windowend=IntegerVector::create(), double ldthr=0.0,
+              const std::string ldcache="", int ldprecision=0,
+              bool single=false, bool polish=true, double ldmemory=4e9, int shotgun=0,
+              int shotgunwindow=200, double shotgunthr=0.1, bool stream=false) {
+  ElnetOptions opt;
+  opt.nthreads = nthreads;
+  opt.scheme = scheme;
+  opt.anderson = anderson;
+  opt.gaptol = gaptol;
+  opt.engine = engine;
+  opt.fistasize = fistasize;
+  opt.joint = joint;
+  opt.sparse = sparse;
+  opt.keeppred = keeppred;
+  opt.maf = maf;
+  opt.callrate = callrate;
+  opt.lowrank = lowrank;
+  opt.windowend = as<arma::Col<int> >(windowend);
+  opt.ldthr = ldthr;
+  opt.ldcache = ldcache;
+  opt.ldprecision = ldprecision;
+  opt.single = single;
+  opt.polish = polish;
+  opt.ldmemory = ldmemory;
+  opt.shotgun = shotgun;
+  opt.shotgunwindow = shotgunwindow;
+  opt.shotgunthr = shotgunthr;
+  return runElnetCore(MixedModel(inv_Sb, inv_Ss), lambda, shrinks, fileName, cor, N, P,
+                      col_skip_pos, col_skip, keepbytes, keepoffset, thr, init, trace, maxiter,
+                      startvec, endvec, opt, stream);
 }
-/**
- lassosum
- functions.cpp
- Purpose: functions to perform lassosum
-
- @author Timothy Mak
- @author Robert Porsch
-
- @version 0.1
-
- */
-// [[Rcpp::interfaces(r, cpp)]]
-
-#include <stdio.h>
-#include <string>
-#include <bitset>
-#include <fstream>
-#include <algorithm>
-#include <iostream>
-#include <cmath>
-#include <RcppArmadillo.h>
-
-// [[Rcpp::depends(RcppArmadillo)]]
-using namespace Rcpp;
-
-/**
- Opens a Plink binary files
-
- @s file name
- @BIT ifstream
- @return is plink file in major mode
 
- */
-
-bool openPlinkBinaryFile(const std::string s, std::ifstream &BIT) {
-  BIT.open(s.c_str(), std::ios::in | std::ios::binary);
-  if (!BIT.is_open()) {
-    throw "Cannot open the bed file";
-  }
+//' Runs elnet for several problems on the same reference panel
+//'
+//' The reference panel is read and standardized once, then each problem (a set of
+//' traits with its correlations, variance matrices, initial betas and blocks) is
+//' solved as by runElnet. With nthreads > 1 and several problems, the problems are
+//' solved in parallel, each on one thread, rather than their blocks.
+//'
+//' @param cor a list of matrices of correlations, one per problem (see runElnet)
+//' @param inv_Sb a list of inverses of the variance-covariance matrix of genetic effects
+//' @param inv_Ss a list of inverses of the residual variance matrix
+//' @param init a list of numeric matrices of beta coefficients
+//' @param startvec a list of the first column of each block, for each problem
+//' @param endvec a list of the last column of each block, for each problem
+//' @param maf see runElnet
+//' @param callrate see runElnet
+//' @param lowrank see runElnet
+//' @param windowend see runElnet
+//' @param ldthr see runElnet
+//' @param ldmemory see runElnet
+//' @param shotgun see runElnet; the blocks are solved with several threads only when
+//' there is one problem
+//' @param shotgunwindow see runElnet
+//' @param shotgunthr see runElnet
+//' @return a list with the results of each problem, as returned by runElnet
+//' @keywords internal
+//'
 
-  // 2) else check for 0.99 SNP/Ind coding
-  // 3) else print warning that file is too old
-  char ch[1];
-  BIT.read(ch, 1);
-  std::bitset<8> b;
-  b = ch[0];
-  bool bfile_SNP_major = false;
-  bool v1_bfile = true;
-  // If v1.00 file format
-  // Magic numbers for .bed file: 00110110 11011000 = v1.00 bed file
-  // std::cerr << "check magic number" << std::endl;
-  if ((b[2] && b[3] && b[5] && b[6]) && !(b[0] || b[1] || b[4] || b[7])) {
-    // Next number
-    BIT.read(ch, 1);
-    b = ch[0];
-    if ((b[0] && b[1] && b[3] && b[4]) && !(b[2] || b[5] || b[6] || b[7])) {
-      // Read SNP/Ind major coding
-      BIT.read(ch, 1);
-      b = ch[0];
-      if (b[0])
-        bfile_SNP_major = true;
-      else
-        bfile_SNP_major = false;
-
-      // if (bfile_SNP_major) std::cerr << "Detected that binary PED file is
-      // v1.00 SNP-major mode" << std::endl;
-      // else std::cerr << "Detected that binary PED file is v1.00
-      // individual-major mode" << std::endl;
-
-    } else
-      v1_bfile = false;
-
-  } else
-    v1_bfile = false;
-  // Reset file if < v1
-  if (!v1_bfile) {
-    Rcerr << "Warning, old BED file <v1.00 : will try to recover..."
-          << std::endl;
-    Rcerr << "  but you should --make-bed from PED )" << std::endl;
-    BIT.close();
-    BIT.clear();
-    BIT.open(s.c_str(), std::ios::in | std::ios::binary);
-    BIT.read(ch, 1);
-    b = ch[0];
-  }
-  // If 0.99 file format
-  if ((!v1_bfile) && (b[1] || b[2] || b[3] || b[4] || b[5] || b[6] || b[7])) {
-    Rcerr << std::endl
-          << " *** Possible problem: guessing that BED is < v0.99      *** "
-          << std::endl;
-    Rcerr << " *** High chance of data corruption, spurious results    *** "
-          << std::endl;
-    Rcerr
-      << " *** Unless you are _sure_ this really is an old BED file *** "
-      << std::endl;
-    Rcerr << " *** you should recreate PED -> BED                      *** "
-          << std::endl
-          << std::endl;
-    bfile_SNP_major = false;
-    BIT.close();
-    BIT.clear();
-    BIT.open(s.c_str(), std::ios::in | std::ios::binary);
-  } else if (!v1_bfile) {
-    if (b[0])
-      bfile_SNP_major = true;
-    else
-      bfile_SNP_major = false;
-    Rcerr << "Binary PED file is v0.99" << std::endl;
-    if (bfile_SNP_major)
-      Rcerr << "Detected that binary PED file is in SNP-major mode"
-            << std::endl;
-      else
-        Rcerr << "Detected that binary PED file is in individual-major mode"
-              << std::endl;
-  }
-  return bfile_SNP_major;
+// [[Rcpp::export]]
+List runElnetBatch(arma::vec& lambda, arma::vec& shrinks, const std::string fileName,
+                   List cor, List inv_Sb, List inv_Ss, int N, int P,
+                   arma::Col<int>& col_skip_pos, arma::Col<int>& col_skip,
+                   arma::Col<int>& keepbytes, arma::Col<int>& keepoffset,
+                   double thr, List init, int trace, int maxiter,
+                   List startvec, List endvec,
+                   int nthreads=1, int scheme=1, int anderson=0,
+                   double gaptol=0.0, int engine=0, int fistasize=1000,
+                   bool joint=false, bool sparse=false, bool keeppred=true,
+                   double maf=0.0, double callrate=0.0, double lowrank=0.0,
+                   IntegerVector windowend=IntegerVector::create(), double ldthr=0.0,
+                   double ldmemory=4e9, int shotgun=0, int shotgunwindow=200,
+                   double shotgunthr=0.1) {
+  ElnetOptions opt;
+  opt.nthreads = nthreads;
+  opt.scheme = scheme;
+  opt.anderson = anderson;
+  opt.gaptol = gaptol;
+  opt.engine = engine;
+  opt.fistasize = fistasize;
+  opt.joint = joint;
+  opt.sparse = sparse;
+  opt.keeppred = keeppred;
+  opt.maf = maf;
+  opt.callrate = callrate;
+  opt.lowrank = lowrank;
+  opt.windowend = as<arma::Col<int> >(windowend);
+  opt.ldthr = ldthr;
+  opt.ldmemory = ldmemory;
+  opt.shotgun = shotgun;
+  opt.shotgunwindow = shotgunwindow;
+  opt.shotgunthr = shotgunthr;
+  std::vector<MixedModel> models;
+  for(int t=0; t < inv_Sb.size(); t++)
+    models.push_back(MixedModel(as<arma::mat>(inv_Sb[t]), as<arma::mat>(inv_Ss[t])));
+  return runElnetBatchCore(models, lambda, shrinks, fileName, cor, N, P, col_skip_pos, col_skip,
+                           keepbytes, keepoffset, thr, init, trace, maxiter, startvec, endvec,
+                           opt);
 }
 
-//' Count number of lines in a text file
+//' Runs elnet on the chunks of the blocks on a pool of threads
 //'
-//' @param fileName Name of file
+//' The chunks, groups of consecutive blocks, are read, standardized and solved as
+//' problems of their own, as by runElnet with stream, on nthreads worker threads
+//' sharing the inputs, rather than in as many R processes each with its own copy.
+//' Up to nthreads chunks are then in memory at once. The paths of the chunks are
+//' merged into those of all the SNPs as with stream, loss and fbeta being those of
+//' the merged betas. With nthreads > 1 and several chunks, each chunk is solved on
+//' one thread; otherwise the blocks of each chunk are solved on nthreads threads.
+//'
+//' @param chunks the chunk of each block, in increasing order
+//' @param ldmemory see runElnet; the chunks solved at once share it
+//' @return a list with the results of each shrink, as returned by runElnet
 //' @keywords internal
 //'
-// [[Rcpp::export]]
-int countlines(const char* fileName) {
-
-  // Stolen from http://stackoverflow.com/questions/3482064/counting-the-number-of-lines-in-a-text-file
-  int number_of_lines = 0;
-  std::string line;
-  std::ifstream myfile(fileName);
 
-  while (std::getline(myfile, line))
-    ++number_of_lines;
-  return number_of_lines;
+// [[Rcpp::export]]
+List runElnetChunks(arma::vec& lambda, arma::vec& shrinks, const std::string fileName,
+                    arma::mat& cor, arma::mat& inv_Sb, arma::mat& inv_Ss, int N, int P,
+                    arma::Col<int>& col_skip_pos, arma::Col<int>& col_skip,
+                    arma::Col<int>& keepbytes, arma::Col<int>& keepoffset,
+                    double thr, arma::mat& init, int trace, int maxiter,
+                    arma::Col<int>& startvec, arma::Col<int>& endvec, arma::Col<int>& chunks,
+                    int nthreads=1, int scheme=1, int anderson=0,
+                    double gaptol=0.0, int engine=0, int fistasize=1000,
+                    bool joint=false, bool sparse=false, bool keeppred=true,
+                    double maf=0.0, double callrate=0.0, double lowrank=0.0,
+                    double ldmemory=4e9, int shotgun=0, int shotgunwindow=200,
+                    double shotgunthr=0.1) {
+  ElnetOptions opt;
+  opt.nthreads = nthreads;
+  opt.scheme = scheme;
+  opt.anderson = anderson;
+  opt.gaptol = gaptol;
+  opt.engine = engine;
+  opt.fistasize = fistasize;
+  opt.joint = joint;
+  opt.sparse = sparse;
+  opt.keeppred = keeppred;
+  opt.maf = maf;
+  opt.callrate = callrate;
+  opt.lowrank = lowrank;
+  opt.ldmemory = ldmemory;
+  opt.shotgun = shotgun;
+  opt.shotgunwindow = shotgunwindow;
+  opt.shotgunthr = shotgunthr;
+  return runElnetChunksCore(MixedModel(inv_Sb, inv_Ss), lambda, shrinks, fileName, cor, N, P,
+                            col_skip_pos, col_skip, keepbytes, keepoffset, thr, init, trace,
+                            maxiter, startvec, endvec, chunks, opt);
 }
 
-//' Multiply genotypeMatrix by a matrix
+//' Splits the SNPs into blocks in little LD with each other
 //'
-//' @param fileName location of bam file
-//' @param N number of subjects
-//' @param P number of positions
-//' @param input the matrix
-//' @param col_skip_pos which variants should we skip
-//' @param col_skip which variants should we skip
-//' @param keepbytes which bytes to keep
-//' @param keepoffset what is the offset
-//' @return an armadillo genotype matrix
-//' @keywords internal
-//'
-// [[Rcpp::export]]
-arma::mat multiBed3(const std::string fileName, int N, int P, const arma::mat input,
-                    arma::Col<int> col_skip_pos, arma::Col<int> col_skip,
-                    arma::Col<int> keepbytes, arma::Col<int> keepoffset,
-                    const int trace) {
-
-  std::ifstream bedFile;
-  bool snpMajor = openPlinkBinaryFile(fileName, bedFile);
-  if (!snpMajor)
-    throw std::runtime_error("We currently have no plans of implementing the "
-                               "individual-major mode. Please use the snp-major "
-                               "format");
-
-  int i = 0;
-  int ii = 0;
-  int iii = 0;
-  const bool colskip = (col_skip_pos.n_elem > 0);
-  unsigned long long int Nbytes = ceil(N / 4.0);
-  const bool selectrow = (keepbytes.n_elem > 0);
-  int n;
-  if (selectrow)
-    n = keepbytes.n_elem;
-  else
-    n = N;
-  int jj;
-
-  arma::mat result = arma::mat(n, input.n_cols, arma::fill::zeros);
-  std::bitset<8> b; // Initiate the bit array
-  char ch[Nbytes];
-
-  int chunk;
-  double step;
-  double Step = 0;
-  if(trace > 0) {
-    chunk = input.n_rows / pow(10, trace);
-    step = 100 / pow(10, trace);
-    // Rcout << "Started C++ program \n";
-  }
-
-  while (i < P) {
-    Rcpp::checkUserInterrupt();
-    if (colskip) {
-      if (ii < col_skip.n_elem) {
-        if (i == col_skip_pos[ii]) {
-          bedFile.seekg(col_skip[ii] * Nbytes, bedFile.cur);
-          i = i + col_skip[ii];
-          ii++;
-          continue;
-        }
-      }
-    }
-
-    if(trace > 0) {
-      if (iii % chunk == 0) {
-        Rcout << Step << "% done\n";
-        Step = Step + step;
-      }
-    }
-
-    bedFile.read(ch, Nbytes); // Read the information
-    if (!bedFile)
-      throw std::runtime_error(
-          "Problem with the BED file...has the FAM/BIM file been changed?");
-
-    int j = 0;
-    if (!selectrow) {
-      for (jj = 0; jj < Nbytes; jj++) {
-        b = ch[jj];
-
-        int c = 0;
-        while (c < 7 && j < N) { // from the original PLINK: 7 because of 8 bits
-          int first = b[c++];
-          int second = b[c++];
-          if (first == 0) {
-            for (int k = 0; k < input.n_cols; k++) {
-              if (input(iii, k) != 0.0) {
-                result(j, k) += (2 - second) * input(iii, k);
-              }
-            }
-          }
-          j++;
-        }
-      }
-    } else {
-      for (jj = 0; jj < keepbytes.n_elem; jj++) {
-        b = ch[keepbytes[jj]];
-
-        int c = keepoffset[jj];
-        int first = b[c++];
-        int second = b[c];
-        if (first == 0) {
-          for (int k = 0; k < input.n_cols; k++) {
-            if (input(iii, k) != 0.0) {
-              result(j, k) += (2 - second) * input(iii, k);
-            }
-          }
-        }
-        j++;
-      }
-    }
-
-    i++;
-    iii++;
-  }
-
-  return result;
-}
-
-
-//' Multiply genotypeMatrix by a matrix (sparse)
-//'
-//' @param fileName location of bam file
-//' @param N number of subjects
-//' @param P number of positions
-//' @param input the matrix
-//' @param col_skip_pos which variants should we skip
-//' @param col_skip which variants should we skip
-//' @param keepbytes which bytes to keep
-//' @param keepoffset what is the offset
-//' @return an armadillo genotype matrix
-//' @keywords internal
-//'
-// [[Rcpp::export]]
-arma::mat multiBed3sp(const std::string fileName, int N, int P,
-                      const arma::vec beta,
-                      const arma::Col<int> nonzeros,
-                      const arma::Col<int> colpos,
-                      const int ncol,
-                      arma::Col<int> col_skip_pos, arma::Col<int> col_skip,
-                      arma::Col<int> keepbytes, arma::Col<int> keepoffset,
-                      const int trace) {
-
-  std::ifstream bedFile;
-  bool snpMajor = openPlinkBinaryFile(fileName, bedFile);
-  if (!snpMajor)
-    throw std::runtime_error("We currently have no plans of implementing the "
-                               "individual-major mode. Please use the snp-major "
-                               "format");
-
-  int i = 0;
-  int ii = 0;
-  int iii = 0;
-  int k = 0;
-  const bool colskip = (col_skip_pos.n_elem > 0);
-  unsigned long long int Nbytes = ceil(N / 4.0);
-  const bool selectrow = (keepbytes.n_elem > 0);
-  int n;
-  if (selectrow)
-    n = keepbytes.n_elem;
-  else
-    n = N;
-  int jj;
-
-  arma::mat result = arma::mat(n, ncol, arma::fill::zeros);
-  std::bitset<8> b; // Initiate the bit array
-  char ch[Nbytes];
-
-  int chunk;
-  double step;
-  double Step = 0;
-  if(trace > 0) {
-    chunk = nonzeros.n_elem / pow(10, trace);
-    step = 100 / pow(10, trace);
-    // Rcout << "Started C++ program \n";
-  }
-
-  while (i < P) {
-    Rcpp::checkUserInterrupt();
-    if (colskip) {
-      if (ii < col_skip.n_elem) {
-        if (i == col_skip_pos[ii]) {
-          bedFile.seekg(col_skip[ii] * Nbytes, bedFile.cur);
-          i = i + col_skip[ii];
-          ii++;
-          continue;
-        }
-      }
-    }
-
-    if(trace > 0) {
-      if (iii % chunk == 0) {
-        Rcout << Step << "% done\n";
-        Step = Step + step;
-      }
-    }
-
-    bedFile.read(ch, Nbytes); // Read the information
-    if (!bedFile)
-      throw std::runtime_error(
-          "Problem with the BED file...has the FAM/BIM file been changed?");
-
-    int j = 0;
-    if (!selectrow) {
-      for (jj = 0; jj < Nbytes; jj++) {
-        b = ch[jj];
-
-        int c = 0;
-        while (c < 7 && j < N) { // from the original PLINK: 7 because of 8 bits
-          int first = b[c++];
-          int second = b[c++];
-          if(nonzeros[iii] > 0) {
-            if (first == 0) {
-              for (int kk = 0; kk < nonzeros[iii]; kk++) {
-                result(j, colpos[k]) += (2 - second) * beta[k];
-                k++;
-              }
-              k -= nonzeros[iii];
-            }
-          }
-          j++;
-        }
-      }
-    } else {
-      for (jj = 0; jj < keepbytes.n_elem; jj++) {
-        b = ch[keepbytes[jj]];
-
-        int c = keepoffset[jj];
-        int first = b[c++];
-        int second = b[c];
-        if(nonzeros[iii] > 0) {
-          if (first == 0) {
-            for (int kk = 0; kk < nonzeros[iii]; kk++) {
-              result(j, colpos[k]) += (2 - second) * beta[k];
-              k++;
-            }
-            k -= nonzeros[iii];
-          }
-        }
-        j++;
-      }
-    }
-
-    k += nonzeros[iii];
-    i++;
-    iii++;
-  }
-
-  return result;
-}
-
-
-
-//' Performs elnet
-//'
-//' @param lambda1 lambda
-//' @param lambda2 lambda
-//' @param X genotype Matrix
-//' @param r correlations
-//' @param inv_Sb the inverse of the variance-covariance matrix of genetic effects
-//' @param inv_Ss the inverse of the residual variance matrix
-//' @param x beta coef
-//' @param thr threshold
-//' @param yhat a vector
-//' @param trace if >1 displays the current iteration
-//' @param maxiter maximal number of iterations
-//' @return conv
-//' @keywords internal
-//'
-// [[Rcpp::export]]
-
-int elnet(double lambda1, double lambda2, const arma::vec& diag, const arma::mat& X,
-          const arma::vec& r, const arma ::mat& inv_Sb,const arma ::mat& inv_Ss ,double thr, arma::vec& x, arma::vec& yhat, int trace, int maxiter)
-{
-
-
-  // diag is basically diag(X'X)
-  // Also, ensure that the yhat=X*x in the input. Usually, both x and yhat are preset to 0.
-  // They are modified in place in this function.
-
-
-  int nq =X.n_rows;
-  int pq =X.n_cols;
-  int q = inv_Sb.n_cols;
-  int p = (pq)/(q);
-
-
-  // avant je comparais r.n_elem avec pq, mais on me donnait warning, donc je compare directement
-  // r.n_elem avec X.n_cols, pareil pour les autres
-  if(r.n_elem != X.n_cols) stop("r.n_elem != X.n_cols");
-  if(x.n_elem != X.n_cols) stop("x.n_elem != X.n_cols");
-  if(yhat.n_elem != X.n_rows) stop("yhat.n_elem != X.n_rows");
-  if(diag.n_elem != X.n_cols) stop("diag.n_elem != X.n_cols");
-
-  double dlx,del,t1,t2,t3, A,S ;
-
-  // j : indice des SNPs, k : indice des traits, m: indice des itérations, u indice pour parcourir le vecteur x ( des betas ),
-  // h indice utilisé pour définir t1 , l incide utilisé pour définir t3
-  int j,k,m,u,h,l;
-
-  // On définit le vecteur x_before ( qui contient les valeurs des betas à l'itération t-1 )
-  arma :: vec x_before(pq,arma::fill::zeros);
-
-  arma::vec Lambda2(pq);
-
-  Lambda2.fill(lambda2);
-  arma::vec denom=diag + Lambda2;
-
-  // On définit le vecteur C , on en aura besoin pour le calcul du terme t3, c'est t(Xj)*Xl*Betal, un vecteur
-  // de taille q
-  arma::vec C(q);
-
-  int conv=0;
-
-  for(m=0;m<maxiter ;m++) {
-    dlx=0.0;
-    // Mon beta est x : c'est un vecteur de taille pq : x = ( q betas pour le SNP1 , q betas pour le SNP 2, .., q betas pour le SNP p )
-
-    x_before = x;
-
-    // boucle sur les SNPS :
-    for (j= 0; j<p; j++) {
-
-      // Pour chaque SNP, on fait une boucle sur les traits :
-      for(k=0; k < q; k++) {
-
-        x.at(q*j+k)=0.0;
-
-
-        // On initialise les termes dont on aura besoin : t1, t2 et t3 ( ce sont les 3 composantes de A comme définie dans la partie théorique )
-        // ainsi que A et S
-
-        t1 = 0.0 ;
-        t2 = 0.0 ;
-        t3 = 0.0 ;
-        A = 0.0 ;
-        S = 0.0 ;
-
-        // RMQ : c++ commence à indicer à partir de 0 ( le premier élément d'un vecteur à l'indice 0),
-        // alors que R commence à indicer à partir de 1 ( le premier élément d'un vecteur à l'indice 1 )
-
-        // On définit le terme t1 :
-
-        for (h =0 ; h<q;h++){
-          if (h!=k) t1=t1+ inv_Sb.at(k,h)*x.at(q*j+h);
-        }
-
-        // Rmq quand j'écrivais (-1/2)*t1, on me donnais t1=0 car il considère
-        // 1/2 comme 0 ( divison entière )
-        t1=-(0.5)*t1;
-
-        // On définit le terme t2 :
-
-        t2 = arma::dot(inv_Ss.row(k),r.subvec(q*j,q*(j+1)-1))  ;
-
-        // On définit le terme t3 :
-
-        for(l=0; l< p;l++){
-          C = trans(X.cols(q*j,q*(j+1)-1))*X.cols(q*l,q*(l+1)-1)*x.subvec(q*l,q*(l+1)-1);
-          if(l!=j) S = S + C.at(k);
-        }
-
-
-        t3 = -1*(inv_Ss.at(k,k))*S;
-
-        A=t1+t2+t3;
-
-        // On définit maintenant la solution Beta
-
-        if (A < 0){
-          if (A + lambda1 <=0 ) {
-            x.at(q*j+k) = (A+ lambda1)/(inv_Ss.at(k,k)*denom.at(q*j+k)+inv_Sb.at(k,k));
-          }
-        }
-
-        if (A > 0){
-          if (A - lambda1>= 0){
-            x.at(q*j+k) = (A- lambda1)/(inv_Ss.at(k,k)*denom.at(q*j+k)+inv_Sb.at(k,k));
-          }
-        }
-
-        if (x.at(q*j+k)==x_before.at(q*j+k) ) continue;
-        del = x.at(q*j+k)-x_before.at(q*j+k);
-        dlx=std::max(dlx,std::abs(del));
-
-        yhat += del*X.col(q*j+k);
-      }
-    }
-
-    checkUserInterrupt();
-    if(trace > 0) Rcout << "Iteration: " << m << "\n";
-
-    if(dlx < thr) {
-      conv=1;
-      break;
-    }
-  }
-
-  return conv;
-}
-
-
-// [[Rcpp::export]]
-int repelnet(double lambda1, double lambda2, arma::vec& diag, arma::mat& X, arma::vec& r, arma ::mat& inv_Sb, arma ::mat& inv_Ss,
-             double thr, arma::vec& x, arma::vec& yhat, int trace, int maxiter,
-             arma::Col<int>& startvec, arma::Col<int>& endvec)
-{
-
-  // Repeatedly call elnet by blocks...
-  int nreps=startvec.n_elem;
-  int out=1;
-  for(int i=0;i < startvec.n_elem; i++) {
-    arma::vec xtouse=x.subvec(startvec(i), endvec(i));
-    arma::vec yhattouse=X.cols(startvec(i), endvec(i)) * xtouse;
-
-    int out2=elnet(lambda1, lambda2,
-                   diag.subvec(startvec(i), endvec(i)),
-                   X.cols(startvec(i), endvec(i)),
-                   r.subvec(startvec(i), endvec(i)),
-                   inv_Sb,inv_Ss,
-                   thr, xtouse,
-                   yhattouse, trace - 1, maxiter);
-    x.subvec(startvec(i), endvec(i))=xtouse;
-    yhat += yhattouse;
-    if(trace > 0) Rcout << "Block: " << i << "\n";
-    out=std::min(out, out2);
-  }
-  return out;
-}
-
-//' imports genotypeMatrix
-//'
-//' @param fileName location of bam file
-//' @param N number of subjects
-//' @param P number of positions
-//' @param col_skip_pos which variants should we skip
-//' @param col_skip which variants should we skip
-//' @param keepbytes which bytes to keep
-//' @param keepoffset what is the offset
-//' @return an armadillo genotype matrix
-//' @keywords internal
-//'
-// [[Rcpp::export]]
-arma::mat genotypeMatrix(const std::string fileName, int N, int P,
-                         arma::Col<int> col_skip_pos, arma::Col<int> col_skip,
-                         arma::Col<int> keepbytes, arma::Col<int> keepoffset,
-                         const int fillmissing) {
-
-  std::ifstream bedFile;
-  bool snpMajor = openPlinkBinaryFile(fileName, bedFile);
-
-  if (!snpMajor)
-    throw std::runtime_error("We currently have no plans of implementing the "
-                               "individual-major mode. Please use the snp-major "
-                               "format");
-
-  int i = 0;
-  int ii = 0;
-  const bool colskip = (col_skip_pos.n_elem > 0);
-  unsigned long long int Nbytes = ceil(N / 4.0);
-  const bool selectrow = (keepbytes.n_elem > 0);
-  int n, p, nskip;
-  if (selectrow)
-    n = keepbytes.n_elem;
-  else
-    n = N;
-
-  if (colskip) {
-    nskip = arma::accu(col_skip);
-    p = P - nskip;
-  }  else
-    p = P;
-
-  int j, jj, iii;
-
-  arma::mat genotypes = arma::mat(n, p, arma::fill::zeros);
-  std::bitset<8> b; // Initiate the bit array
-  char ch[Nbytes];
-
-  iii=0;
-  while (i < P) {
-    // Rcout << i << std::endl;
-    Rcpp::checkUserInterrupt();
-    if (colskip) {
-      if (ii < col_skip.n_elem) {
-        if (i == col_skip_pos[ii]) {
-          bedFile.seekg(col_skip[ii] * Nbytes, bedFile.cur);
-          i = i + col_skip[ii];
-          ii++;
-          continue;
-        }
-      }
-    }
-
-    bedFile.read(ch, Nbytes); // Read the information
-    if (!bedFile)
-      throw std::runtime_error(
-          "Problem with the BED file...has the FAM/BIM file been changed?");
-
-    j = 0;
-    if (!selectrow) {
-      for (jj = 0; jj < Nbytes; jj++) {
-        b = ch[jj];
-
-        int c = 0;
-        while (c < 7 &&
-               j < N) { // from the original PLINK: 7 because of 8 bits
-          int first = b[c++];
-          int second = b[c++];
-          if (first == 0) {
-            genotypes(j, iii) = (2 - second);
-          }
-          if(fillmissing == 0 && first == 1 && second == 0) genotypes(j, iii) =arma::datum::nan;
-          j++;
-        }
-      }
-    } else {
-      for (jj = 0; jj < keepbytes.n_elem; jj++) {
-        b = ch[keepbytes[jj]];
-
-        int c = keepoffset[jj];
-        int first = b[c++];
-        int second = b[c];
-        if (first == 0) {
-          genotypes(j, iii) = (2 - second);
-        }
-        if(fillmissing == 0 && first == 1 && second == 0) genotypes(j, iii) =arma::datum::nan;
-        j++;
-      }
-    }
-    i++;
-    iii++;
-  }
-  return genotypes;
-}
-
-
-//' normalize genotype matrix
-//'
-//' @param genotypes a armadillo genotype matrix
-//' @return standard deviation
-//' @keywords internal
-//'
-// [[Rcpp::export]]
-arma::vec normalize(arma::mat &genotypes)
-{
-  int k = genotypes.n_cols;
-  int n = genotypes.n_rows;
-  arma::vec sd(k);
-  for (int i = 0; i < k; ++i) {
-    double m = arma::mean(genotypes.col(i));
-    arma::vec mm(n); mm.fill(m);
-    sd(i) = arma::stddev(genotypes.col(i));
-    // sd(i) = 1.0;
-    genotypes.col(i) = arma::normalise(genotypes.col(i) - mm);
-  }
-  return sd;
-}
-
-
-// We will build a function that could construct the Genotype
-// matrix for multiple phenotypes
-
-//' Constructs a Genotype Matrix for multiples phenotypes from a
-//' genotype matrix for 1 phenotype
-//'
-//' @param GenotypeMatrix genotype matrix for one phenotype
-//' @param q number of phenotypes
-//' @return an armadillo genotype matrix
-//' @keywords internal
-
-// [[Rcpp::export]]
-arma::mat GenotypeMatrixMultiplePhenotypes(const arma::mat& GenotypeMatrix, int q){
-  int p = GenotypeMatrix.n_cols;// number of SNPs
-  int n = GenotypeMatrix.n_rows;// number of subjects
-
-  arma::mat GenotypeMatrixMultiPheno (n*q,q*p);
-  arma::mat GenotypeMatrix_col(n,q*p);
-
-  // Step 1 : we have to duplicate the rows and columns of the matrix
-  // the number of duplicate is the number of phenotypes we have
-
-  // We start by duplicating the columns
-  for(int i=1;i<p+1 ;i ++) {
-    for(int j =(i-1)*q;j<i*q;j++) {
-      GenotypeMatrix_col.col(j) = GenotypeMatrix.col(i-1);
-    }
-  }
-
-  // we now duplicate the rows
-  for(int i=1;i<n+1 ;i ++) {
-    for(int j =(i-1)*q;j<i*q;j++) {
-      GenotypeMatrixMultiPheno.row(j) = GenotypeMatrix_col.row(i-1);
-    }
-  }
-
-  // Step 2 : Some elements should now be set to 0
-
-  for(int i=1;i<n+1 ;i ++) {
-    for(int j=1;j<p+1 ;j ++) {
-      GenotypeMatrixMultiPheno.cols((j-1)*q,j*q-1).rows((i-1)*q,i*q-1) = arma::diagmat(GenotypeMatrixMultiPheno.cols((j-1)*q,j*q-1).rows((i-1)*q,i*q-1));
-    }
-  }
-
-  return GenotypeMatrixMultiPheno;
-}
-
-// We will build a function that could construct the sd vector
-// for multiple traits
-
-//' Constructs an sd vector for multiple phenotypes from a
-//' sd vector for 1 phenotype
-//'
-//' @param sd  vector of sd for one phenotype
-//' @param q number of phenotypes
-//' @return an armadillo sd vector
-//' @keywords internal
-
-// [[Rcpp::export]]
-arma::vec sd_MultiplePhenotypes(const arma::vec& sd, int q){
-  int p = sd.n_elem;// number of SNPs
-
-  arma::vec sd_MultiPheno (q*p,arma::fill::zeros);
-
-  // we duplicate the elements of sd q times
-
-  for(int i=1;i<p+1 ;i ++) {
-    for(int j =(i-1)*q;j<i*q;j++) {
-      sd_MultiPheno.at(j) = sd.at(i-1);
-    }
-  }
-
-  return sd_MultiPheno;
-}
-
-//' Runs elnet with various parameters
-//'
-//' @param lambda1 a vector of lambdas (lambda2 is 0)
-//' @param fileName the file name of the reference panel
-//' @param cor a matrix of correlations, rows represent phenotypes, and columns represent SNPs
-//' @param inv_Sb the inverse of the variance-covariance matrix of genetic effects
-//' @param inv_Ss the inverse of the residual variance matrix
+//' The blocks of at most maxsize SNPs which minimize the sum of the squared
+//' correlations between the SNPs of different blocks, within the windows of the SNPs
+//' (see ldBlockPartition). The windows should not span several chromosomes. The LD is
+//' computed from the reference panel: an LD cache (see ld_cache.h) only holds the LD
+//' within the blocks it was written for, not that between them that the split minimizes.
+//'
+//' @param fileName the file name of the reference panel
 //' @param N number of subjects
 //' @param P number of position in reference file
 //' @param col_skip_posR which variants should we skip
 //' @param col_skipR which variants should we skip
 //' @param keepbytesR required to read the PLINK file
 //' @param keepoffsetR required to read the PLINK file
-//' @param thr threshold
-//' @param init a numeric matrix of beta coefficients
-//' @param trace if >1 displays the current iteration
-//' @param maxiter maximal number of iterations
-//' @param Constant a constant to multiply the standardized genotype matrix
-//' @return a list of results
+//' @param windowend the last SNP (0-based, over the SNPs selected) within the window of
+//' each SNP
+//' @param ldthr the correlations below ldthr in absolute value are ignored
+//' @param maxsize the maximum number of SNPs of a block
+//' @param nthreads number of threads used to compute the LD
+//' @return a list with startvec and endvec, the first and last SNP (0-based) of each
+//' block, cost, the sum of the squared correlations between the SNPs of different
+//' blocks, and total, that of all the pairs of SNPs within the windows
 //' @keywords internal
 //'
 
 // [[Rcpp::export]]
-
-
-
-List runElnet(arma::vec& lambda, double shrink, const std::string fileName,
-              arma::mat& cor, arma ::mat& inv_Sb ,arma ::mat& inv_Ss,int N, int P,
+List ldBlocks(const std::string fileName, int N, int P,
               arma::Col<int>& col_skip_pos, arma::Col<int>& col_skip,
               arma::Col<int>& keepbytes, arma::Col<int>& keepoffset,
-              double thr, arma::mat& init, int trace, int maxiter,
-              arma::Col<int>& startvec, arma::Col<int>& endvec) {
-  // a) read bed file
-  // b) standardize genotype matrix
-  // c) multiply by constatant factor
-  // d) perfrom elnet
-
-  // Rcout << "ABC" << std::endl;
-
-  int i,j;
-
-  arma::mat genotypes_one_phenotype = genotypeMatrix(fileName, N, P, col_skip_pos, col_skip, keepbytes,
-                                                     keepoffset, 1);
-
-  // On commence par normaliser la matrice génotype pour un seul phénotype
-
-  arma::vec sd = normalize(genotypes_one_phenotype);
-  // On construit le vecteur sd pour plusieurs phenotypes
-  arma::vec sd_MultiplePheno = sd_MultiplePhenotypes(sd,inv_Sb.n_cols);
-
-  genotypes_one_phenotype *= sqrt(1.0 - shrink);
-
-  // Ensuite on construit la matrice pour plusieurs phénotypes
-
-  arma::mat genotypes = GenotypeMatrixMultiplePhenotypes(genotypes_one_phenotype,inv_Sb.n_cols);
-
-  // Rcout << "DEF" << std::endl;
-
-  // Ici, je transforme cor et init en des vecteurs pour pouvoir travailler avec :
-
-  arma::vec r(cor.n_rows*cor.n_cols,arma::fill::zeros);
-  int b = 0;
-  for(int a=0; a < r.n_elem; a+=cor.n_rows) {
-    r.subvec(a,a+cor.n_rows-1) = cor.col(b);
-    b=b+1;
-  }
-
-  arma::vec x(init.n_rows*init.n_cols,arma::fill::zeros);
-  int q = 0;
-  for(int e=0; e < x.n_elem; e+=init.n_rows) {
-    x.subvec(e,e+init.n_rows-1) = init.col(q);
-    q=q+1;
-  }
-
-  if (genotypes.n_cols != r.n_elem) {
-    throw std::runtime_error("Number of positions in reference file is not "
-                               "equal the number of regression coefficients");
-  }
-
-
-  arma::Col<int> conv(lambda.n_elem);
-  int len = r.n_elem;
-
-  arma::mat beta(len, lambda.n_elem);
-  arma::mat pred(genotypes.n_rows, lambda.n_elem); pred.zeros();
-  arma::vec out(lambda.n_elem);
-  arma::vec loss(lambda.n_elem);
-  arma::vec diag(r.n_elem); diag.fill(1.0 - shrink);
-  // Rcout << "HIJ" << std::endl;
-
-  for(j=0; j < diag.n_elem; j++) {
-    if(sd_MultiplePheno(j) == 0.0) diag(j) = 0.0;
-  }
-  // Rcout << "LMN" << std::endl;
-
-  arma::vec fbeta(lambda.n_elem);
-  arma::vec yhat(genotypes.n_rows);
-  // yhat = genotypes * x;
-
-
-  // Rcout << "Starting loop" << std::endl;
-  for (i = 0; i < lambda.n_elem; ++i) {
-    if (trace > 0)
-      Rcout << "lambda: " << lambda(i) << "\n" << std::endl;
-    out(i) =
-      repelnet(lambda(i), shrink, diag,genotypes, r,inv_Sb,inv_Ss, thr, x, yhat, trace-1, maxiter,
-               startvec, endvec);
-    beta.col(i) = x;
-    for(j=0; j < beta.n_rows; j++) {
-      if(sd_MultiplePheno(j) == 0.0) beta(j,i)=beta(j,i) * shrink;
-    }
-
-    if (out(i) != 1) {
-      throw std::runtime_error("Not converging.....");
-    }
-
-    pred.col(i) = yhat;
-
-    // We calculate inv_B and inv_Se, we need to calculate Loss and fbeta
-
-    arma::mat inv_B = arma::kron(arma::eye(genotypes_one_phenotype.n_cols,genotypes_one_phenotype.n_cols),inv_Sb);
-    arma::mat inv_Se = arma::kron(arma::eye(genotypes_one_phenotype.n_rows,genotypes_one_phenotype.n_rows),inv_Ss);
-
-    // We need the In_Ss matrix in size (pq,pq) for when we calculate the Loss and fbeta
-    arma::mat inv_Ss_pq = arma::kron(arma::eye(genotypes_one_phenotype.n_cols,genotypes_one_phenotype.n_cols),inv_Ss);
-
-    loss(i) = arma::as_scalar(arma::trans(yhat)*inv_Se*yhat - 2.0*(arma::trans(x))*inv_Ss_pq*r);
-    
-    fbeta(i) = arma::as_scalar(loss(i) + 2.0 * arma::sum(arma::abs(x)) * lambda(i) +
-      shrink*(arma::trans(x))*inv_Ss_pq*x + (arma::trans(x))*inv_B*x);
-  }
-
-  return List::create(Named("lambda") = lambda,
-                      Named("beta") = beta,
-                      Named("conv") = out,
-                      Named("pred") = pred,
-                      Named("loss") = loss,
-                      Named("fbeta") = fbeta,
-                      Named("sd_MultiplePheno")= sd_MultiplePheno);
+              IntegerVector windowend, double ldthr=0.0, int maxsize=1000,
+              int nthreads=1) {
+  arma::mat genotypes = readGenotypes(fileName, N, P, col_skip_pos, col_skip, keepbytes,
+                                      keepoffset, 1, NULL);
+  normalize(genotypes);
+  arma::Col<int> end = as<arma::Col<int> >(windowend);
+  if(end.n_elem != genotypes.n_cols)
+    throw std::runtime_error("windowend must have one element per SNP selected");
+
+  arma::sp_mat R = bandedLD(genotypes, end, ldthr, nthreads);
+  genotypes.reset();
+  LdBlocks blocks = ldBlockPartition(R, maxsize);
+  return List::create(Named("startvec") = blocks.startvec,
+                      Named("endvec") = blocks.endvec,
+                      Named("cost") = blocks.cost,
+                      Named("total") = blocks.total);
 }
@@ -0,0 +1,133 @@
+/**
+   lassosum
+   ld_blocks.h
+   Purpose: split the SNPs into blocks in little LD with each other
+
+   The blocks are solved independently of each other, ignoring the LD
+   between them: the weaker the correlations between the SNPs of different
+   blocks, the closer the solution to that of all the SNPs at once, while a
+   single block costs n*p for every update and its LD matrix p^2.
+
+   ldBlockPartition chooses the blocks of at most maxsize consecutive SNPs
+   which minimize the sum of the squared correlations between the SNPs of
+   different blocks, over the pairs of SNPs of a banded LD matrix (see
+   bandedLD). With cut(i, j) the sum of the squared correlations of the
+   SNPs from i to j - 1 with the SNPs from j on, the least cost of blocks
+   covering the SNPs before j is f(j) = min f(i) + cut(i, j) over the i from
+   j - maxsize to j - 1, a dynamic programming over the SNPs. Before the
+   first SNP in LD with the SNPs from j on, cut(i, j) no longer depends on
+   i: the minimum of f over these i is kept as they slide, so that a SNP
+   costs the width of the band rather than maxsize.
+
+ */
+#ifndef LASSOSUM_LD_BLOCKS_H
+#define LASSOSUM_LD_BLOCKS_H
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <RcppArmadillo.h>
+
+struct LdBlocks {
+  arma::Col<int> startvec;  // the first SNP of each block
+  arma::Col<int> endvec;    // the last SNP of each block
+  double cost;              // the sum of the squared correlations between blocks
+  double total;             // the sum of the squared correlations of the pairs of SNPs of R
+};
+
+/**
+   Splits the SNPs of a banded LD matrix into blocks
+
+   @R the banded LD matrix of the SNPs, symmetric, with the correlations of
+   the standardized genotypes (see bandedLD)
+   @maxsize the maximum number of SNPs of a block
+   @return the blocks, the cost of the split and the total it is out of;
+   between two splits of the same cost, the one with fewer blocks
+
+ */
+inline LdBlocks ldBlockPartition(const arma::sp_mat& R, int maxsize) {
+  int p = R.n_cols;
+  int a, i, j;
+  const arma::uword* rowind = R.row_indices;
+  const arma::uword* colptr = R.col_ptrs;
+  const double* values = R.values;
+  maxsize = std::max(maxsize, 1);
+
+  // t(a) : somme des r^2 de a avec les SNPs à partir de la frontière j
+  // low[j] : le premier SNP en LD avec un SNP à partir de j
+  arma::vec t(p, arma::fill::zeros);
+  std::vector<int> low(p + 1, p);
+  double total = 0.0;
+  for(j=0; j < p; j++) {
+    for(arma::uword s=colptr[j]; s < colptr[j+1]; s++) {
+      a = rowind[s];
+      if(a >= j) continue;
+      t(a) += values[s] * values[s];
+      total += values[s] * values[s];
+    }
+    low[j] = (colptr[j+1] > colptr[j]) ? std::min(j, (int) rowind[colptr[j]]) : j;
+  }
+  for(j=p-1; j >= 0; j--) low[j] = std::min(low[j], low[j+1]);
+
+  std::vector<double> f(p + 1, 0.0);
+  std::vector<int> nblocks(p + 1, 0), from(p + 1, 0);
+  auto better = [&](double fi, int ni, double fk, int nk) {
+    return fi < fk || (fi == fk && ni < nk);
+  };
+  // Les i avant low[j], par f croissant
+  std::deque<int> far;
+  int next = 0;
+  for(j=1; j <= p; j++) {
+    // t pour la frontière j : on retire les r^2 avec le SNP j - 1
+    for(arma::uword s=colptr[j-1]; s < colptr[j]; s++) {
+      a = rowind[s];
+      if(a < j - 1) t(a) -= values[s] * values[s];
+    }
+    int first = std::max(0, j - maxsize);
+    int L = std::min(low[j], j - 1);
+
+    double best = 0.0;
+    int bestn = 0, besti = -1;
+    // Les i après L : cut(i, j) = somme de t de i à j - 1
+    double c = 0.0;
+    for(a=j-1; a >= L; a--) {
+      c += t(a);
+      if(a > L && a >= first && (besti < 0 || better(f[a] + c, nblocks[a] + 1, best, bestn))) {
+        best = f[a] + c;
+        bestn = nblocks[a] + 1;
+        besti = a;
+      }
+    }
+    // Les i jusqu'à L : cut(i, j) = cut(L, j)
+    for(; next <= L; next++) {
+      while(!far.empty() && !better(f[far.back()], nblocks[far.back()], f[next], nblocks[next]))
+        far.pop_back();
+      far.push_back(next);
+    }
+    while(!far.empty() && far.front() < first) far.pop_front();
+    if(!far.empty()) {
+      i = far.front();
+      if(besti < 0 || better(f[i] + c, nblocks[i] + 1, best, bestn)) {
+        best = f[i] + c;
+        bestn = nblocks[i] + 1;
+        besti = i;
+      }
+    }
+    f[j] = best;
+    nblocks[j] = bestn;
+    from[j] = besti;
+  }
+
+  LdBlocks blocks;
+  blocks.cost = f[p];
+  blocks.total = total;
+  blocks.startvec.set_size(nblocks[p]);
+  blocks.endvec.set_size(nblocks[p]);
+  for(j=p, i=nblocks[p]-1; j > 0; j=from[j], i--) {
+    blocks.startvec(i) = from[j];
+    blocks.endvec(i) = j - 1;
+  }
+  return blocks;
+}
+
+#endif
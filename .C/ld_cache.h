@@ -0,0 +1,349 @@
+/**
+   lassosum
+   ld_cache.h
+   Purpose: keep the LD matrices of the blocks on disk between runs
+
+   The reference panel and its blocks seldom change from one run to the
+   next, yet every run reads the .bed file, standardizes the genotypes and
+   recomputes the LD of the blocks. The LD matrices of the blocks, with the
+   SNPs kept and the sd of every SNP, are written once to a cache file; the
+   next runs on the same selection map the file in memory and solve the
+   blocks on their LD matrices, without reading the genotypes.
+
+   The file is a header, the tables, then the LD matrices of the blocks,
+   each as a full column-major matrix of floats, or of 16-bit integers times
+   a scale for the block. Every section starts on 8 bytes. The header holds
+   a key, a hash of the identity of the .bed file (size and time of last
+   modification), of the selection of subjects and SNPs, and of the blocks:
+   a cache with another key is not used.
+
+ */
+#ifndef LASSOSUM_LD_CACHE_H
+#define LASSOSUM_LD_CACHE_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <stdint.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include <RcppArmadillo.h>
+
+// Precisions of the LD matrices in the cache
+enum LdPrecision { LD_FLOAT32 = 0, LD_INT16 = 1 };
+
+struct LdCacheHeader {
+  char magic[8];        // "LSLDCACH"
+  uint32_t version;
+  uint32_t precision;   // an LdPrecision
+  uint64_t key;
+  uint64_t nsubjects;
+  uint64_t nsnps;       // every SNP, sd being given for each
+  uint64_t nkept;       // the SNPs in the LD matrices (see SnpFilter)
+  uint64_t nconstant;
+  uint64_t nblocks;
+};
+
+struct LdCacheBlock {
+  uint64_t start;       // the first SNP of the block, over the SNPs kept
+  uint64_t size;        // its number of SNPs
+  uint64_t offset;      // the position of its LD matrix in the file
+  double scale;         // with LD_INT16, the LD is the integers times scale
+};
+
+static const char ldCacheMagic[8] = {'L', 'S', 'L', 'D', 'C', 'A', 'C', 'H'};
+static const uint32_t ldCacheVersion = 1;
+
+inline uint64_t ldCacheAlign(uint64_t n) {
+  return (n + 7) / 8 * 8;
+}
+
+/**
+   The key of a cache: a 64-bit FNV-1a hash of everything it depends on
+
+ */
+struct LdCacheKey {
+  uint64_t value;
+
+  LdCacheKey() : value(14695981039346656037ULL) {}
+
+  void add(const void* data, size_t bytes) {
+    const unsigned char* c = (const unsigned char*) data;
+    for(size_t i=0; i < bytes; i++) {
+      value ^= c[i];
+      value *= 1099511628211ULL;
+    }
+  }
+  template <class T> void add(const T& v) { add(&v, sizeof(T)); }
+  template <class T> void add(const arma::Col<T>& v) {
+    uint64_t n = v.n_elem;
+    add(n);
+    if(n > 0) add(v.memptr(), n * sizeof(T));
+  }
+
+  // The identity of a file: its size and time of last modification
+  bool addFile(const std::string& fileName) {
+    struct stat st;
+    if(stat(fileName.c_str(), &st) != 0) return false;
+    int64_t size = st.st_size, mtime = st.st_mtime;
+    add(size);
+    add(mtime);
+    return true;
+  }
+};
+
+/**
+   A cache file, mapped in memory
+
+ */
+class LdCache {
+public:
+  LdCache() : data(NULL), size(0), mapped(false) {}
+  ~LdCache() { close(); }
+
+  /**
+     Maps a cache file
+
+     @fileName the cache file
+     @key the key the cache must have
+     @return false if there is no such file, or if it is not a cache of this
+     key; the cache is then left closed
+
+   */
+  bool open(const std::string& fileName, uint64_t key) {
+    close();
+#ifndef _WIN32
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if(fd < 0) return false;
+    struct stat st;
+    if(fstat(fd, &st) == 0 && st.st_size > 0) {
+      void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if(p != MAP_FAILED) {
+        data = (const char*) p;
+        size = st.st_size;
+        mapped = true;
+      }
+    }
+    ::close(fd);
+#else
+    std::ifstream in(fileName.c_str(), std::ios::binary);
+    if(in) {
+      buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+      data = buffer.data();
+      size = buffer.size();
+    }
+#endif
+    if(data == NULL || !check(key)) {
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  void close() {
+#ifndef _WIN32
+    if(mapped) munmap((void*) data, size);
+#else
+    std::vector<char>().swap(buffer);
+#endif
+    data = NULL;
+    size = 0;
+    mapped = false;
+  }
+
+  const LdCacheHeader& header() const { return *(const LdCacheHeader*) data; }
+  int nsubjects() const { return header().nsubjects; }
+  int nblocks() const { return header().nblocks; }
+  const LdCacheBlock& block(int i) const { return blocks()[i]; }
+
+  arma::vec sd() const {
+    return arma::vec(section<double>(sdOffset()), header().nsnps);
+  }
+  arma::vec means() const {
+    return arma::vec(section<double>(meansOffset()), header().nkept);
+  }
+  arma::uvec kept() const { return indices(keptOffset(), header().nkept); }
+  arma::uvec constant() const { return indices(constantOffset(), header().nconstant); }
+
+  /**
+     The LD matrix of block i, in double precision
+
+   */
+  arma::mat ld(int i) const {
+    const LdCacheBlock& b = block(i);
+    arma::mat R(b.size, b.size);
+    ld(i, R);
+    return R;
+  }
+
+  /**
+     Decodes the LD matrix of block i into R, of its size (e.g. a view of a
+     workspace)
+
+   */
+  void ld(int i, arma::mat& R) const {
+    const LdCacheBlock& b = block(i);
+    double* out = R.memptr();
+    uint64_t n = b.size * b.size;
+    if(header().precision == LD_INT16) {
+      const int16_t* in = section<int16_t>(b.offset);
+      for(uint64_t t=0; t < n; t++) out[t] = in[t] * b.scale;
+    } else {
+      const float* in = section<float>(b.offset);
+      for(uint64_t t=0; t < n; t++) out[t] = in[t];
+    }
+  }
+
+private:
+  const char* data;
+  size_t size;
+  bool mapped;
+#ifdef _WIN32
+  std::vector<char> buffer;
+#endif
+
+  LdCache(const LdCache&);
+  LdCache& operator=(const LdCache&);
+
+  template <class T> const T* section(uint64_t offset) const {
+    return (const T*) (data + offset);
+  }
+  arma::uvec indices(uint64_t offset, uint64_t n) const {
+    const uint64_t* in = section<uint64_t>(offset);
+    arma::uvec v(n);
+    for(uint64_t t=0; t < n; t++) v(t) = in[t];
+    return v;
+  }
+  uint64_t sdOffset() const { return ldCacheAlign(sizeof(LdCacheHeader)); }
+  uint64_t meansOffset() const { return sdOffset() + ldCacheAlign(8 * header().nsnps); }
+  uint64_t keptOffset() const { return meansOffset() + ldCacheAlign(8 * header().nkept); }
+  uint64_t constantOffset() const { return keptOffset() + 8 * header().nkept; }
+  uint64_t blocksOffset() const { return constantOffset() + 8 * header().nconstant; }
+  const LdCacheBlock* blocks() const { return section<LdCacheBlock>(blocksOffset()); }
+
+  // Whether the file is a cache of key, and all its sections are within it
+  bool check(uint64_t key) const {
+    if(size < sizeof(LdCacheHeader)) return false;
+    const LdCacheHeader& h = header();
+    if(std::memcmp(h.magic, ldCacheMagic, 8) != 0 || h.version != ldCacheVersion ||
+       h.key != key || h.precision > LD_INT16)
+      return false;
+    if(blocksOffset() + h.nblocks * sizeof(LdCacheBlock) > size) return false;
+    uint64_t element = (h.precision == LD_INT16) ? sizeof(int16_t) : sizeof(float);
+    for(uint64_t i=0; i < h.nblocks; i++) {
+      const LdCacheBlock& b = blocks()[i];
+      if(b.start + b.size > h.nkept || b.offset + b.size * b.size * element > size) return false;
+    }
+    return true;
+  }
+};
+
+/**
+   Writes a cache file
+
+   The file is written under a temporary name then renamed, so that a run
+   never maps a cache being written.
+
+   @fileName the cache file
+   @key its key (see LdCacheKey)
+   @precision an LdPrecision
+   @nsubjects the number of subjects of the reference panel
+   @sd the sd of every SNP
+   @means the means of the SNPs kept
+   @kept the SNPs kept, and the SNPs of zero variance (see SnpFilter)
+   @start the first SNP of each block, over the SNPs kept
+   @blocksize the number of SNPs of each block
+   @ld ld(i) returns the LD matrix of block i; the blocks are computed and
+   written one at a time
+   @return false if the file could not be written
+
+ */
+template <class Fn>
+bool writeLdCache(const std::string& fileName, uint64_t key, int precision, int nsubjects,
+                  const arma::vec& sd, const arma::vec& means, const arma::uvec& kept,
+                  const arma::uvec& constant, const arma::Col<int>& start,
+                  const arma::Col<int>& blocksize, Fn ld) {
+  LdCacheHeader h;
+  std::memcpy(h.magic, ldCacheMagic, 8);
+  h.version = ldCacheVersion;
+  h.precision = precision;
+  h.key = key;
+  h.nsubjects = nsubjects;
+  h.nsnps = sd.n_elem;
+  h.nkept = kept.n_elem;
+  h.nconstant = constant.n_elem;
+  h.nblocks = start.n_elem;
+
+  // The offsets of the LD matrices follow the tables
+  uint64_t element = (precision == LD_INT16) ? sizeof(int16_t) : sizeof(float);
+  uint64_t offset = ldCacheAlign(sizeof(LdCacheHeader)) + ldCacheAlign(8 * h.nsnps) +
+    ldCacheAlign(8 * h.nkept) + 8 * h.nkept + 8 * h.nconstant +
+    h.nblocks * sizeof(LdCacheBlock);
+  std::vector<LdCacheBlock> blocks(h.nblocks);
+  for(uint64_t i=0; i < h.nblocks; i++) {
+    blocks[i].start = start(i);
+    blocks[i].size = blocksize(i);
+    blocks[i].offset = offset;
+    blocks[i].scale = 1.0;
+    offset += ldCacheAlign(blocks[i].size * blocks[i].size * element);
+  }
+
+  std::string tmpName = fileName + ".tmp";
+  std::ofstream out(tmpName.c_str(), std::ios::binary | std::ios::trunc);
+  if(!out) return false;
+  const char zeros[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+  auto pad = [&](uint64_t bytes) { out.write(zeros, ldCacheAlign(bytes) - bytes); };
+  auto writeIndices = [&](const arma::uvec& v) {
+    for(arma::uword t=0; t < v.n_elem; t++) {
+      uint64_t j = v(t);
+      out.write((const char*) &j, 8);
+    }
+  };
+
+  out.write((const char*) &h, sizeof(h));
+  pad(sizeof(h));
+  out.write((const char*) sd.memptr(), 8 * h.nsnps);
+  out.write((const char*) means.memptr(), 8 * h.nkept);
+  writeIndices(kept);
+  writeIndices(constant);
+  std::streampos table = out.tellp();
+  out.write((const char*) blocks.data(), h.nblocks * sizeof(LdCacheBlock));
+
+  for(uint64_t i=0; i < h.nblocks; i++) {
+    uint64_t n = blocks[i].size * blocks[i].size;
+    if(n == 0) continue;
+    arma::mat R = ld(i);
+    const double* in = R.memptr();
+    if(precision == LD_INT16) {
+      double maxabs = 0.0;
+      for(uint64_t t=0; t < n; t++) maxabs = std::max(maxabs, std::abs(in[t]));
+      blocks[i].scale = (maxabs > 0.0) ? maxabs / 32767.0 : 1.0;
+      std::vector<int16_t> v(n);
+      for(uint64_t t=0; t < n; t++) v[t] = (int16_t) std::lround(in[t] / blocks[i].scale);
+      out.write((const char*) v.data(), n * sizeof(int16_t));
+    } else {
+      std::vector<float> v(in, in + n);
+      out.write((const char*) v.data(), n * sizeof(float));
+    }
+    pad(n * element);
+  }
+  // The scales are only known now
+  out.seekp(table);
+  out.write((const char*) blocks.data(), h.nblocks * sizeof(LdCacheBlock));
+  out.close();
+  if(!out) {
+    std::remove(tmpName.c_str());
+    return false;
+  }
+  std::remove(fileName.c_str());
+  return std::rename(tmpName.c_str(), fileName.c_str()) == 0;
+}
+
+#endif
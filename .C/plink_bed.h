@@ -0,0 +1,327 @@
+/**
+   lassosum
+   plink_bed.h
+   Purpose: read the genotypes of a PLINK .bed file
+
+   The reading of the genotypes shared by the linear and the mixed models:
+   openPlinkBinaryFile checks the header of the .bed file, readGenotypes
+   reads the SNPs selected, dropping those SnpFilter leaves out, and
+   normalizeColumns standardizes them. sparseBetaInput is the body of
+   multiBed3spInput, exported by both models.
+
+ */
+#ifndef LASSOSUM_PLINK_BED_H
+#define LASSOSUM_PLINK_BED_H
+
+#include <string>
+#include <bitset>
+#include <fstream>
+#include <vector>
+#include <atomic>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <RcppArmadillo.h>
+
+/**
+ Opens a Plink binary files
+
+ @s file name
+ @BIT ifstream
+ @quiet if true, the warnings about .bed files older than v1.00 are not
+ printed, so that the file can be opened off the main thread
+ @return is plink file in major mode
+
+ */
+
+inline bool openPlinkBinaryFile(const std::string s, std::ifstream &BIT,
+                                bool quiet = false) {
+  BIT.open(s.c_str(), std::ios::in | std::ios::binary);
+  if (!BIT.is_open()) {
+    throw "Cannot open the bed file";
+  }
+
+  // 2) else check for 0.99 SNP/Ind coding
+  // 3) else print warning that file is too old
+  char ch[1];
+  BIT.read(ch, 1);
+  std::bitset<8> b;
+  b = ch[0];
+  bool bfile_SNP_major = false;
+  bool v1_bfile = true;
+  // If v1.00 file format
+  // Magic numbers for .bed file: 00110110 11011000 = v1.00 bed file
+  // std::cerr << "check magic number" << std::endl;
+  if ((b[2] && b[3] && b[5] && b[6]) && !(b[0] || b[1] || b[4] || b[7])) {
+    // Next number
+    BIT.read(ch, 1);
+    b = ch[0];
+    if ((b[0] && b[1] && b[3] && b[4]) && !(b[2] || b[5] || b[6] || b[7])) {
+      // Read SNP/Ind major coding
+      BIT.read(ch, 1);
+      b = ch[0];
+      if (b[0])
+        bfile_SNP_major = true;
+      else
+        bfile_SNP_major = false;
+
+      // if (bfile_SNP_major) std::cerr << "Detected that binary PED file is
+      // v1.00 SNP-major mode" << std::endl;
+      // else std::cerr << "Detected that binary PED file is v1.00
+      // individual-major mode" << std::endl;
+
+    } else
+      v1_bfile = false;
+
+  } else
+    v1_bfile = false;
+  // Reset file if < v1
+  if (!v1_bfile) {
+    if (!quiet) {
+      Rcpp::Rcerr << "Warning, old BED file <v1.00 : will try to recover..."
+            << std::endl;
+      Rcpp::Rcerr << "  but you should --make-bed from PED )" << std::endl;
+    }
+    BIT.close();
+    BIT.clear();
+    BIT.open(s.c_str(), std::ios::in | std::ios::binary);
+    BIT.read(ch, 1);
+    b = ch[0];
+  }
+  // If 0.99 file format
+  if ((!v1_bfile) && (b[1] || b[2] || b[3] || b[4] || b[5] || b[6] || b[7])) {
+    if (!quiet) {
+      Rcpp::Rcerr << std::endl
+            << " *** Possible problem: guessing that BED is < v0.99      *** "
+            << std::endl;
+      Rcpp::Rcerr << " *** High chance of data corruption, spurious results    *** "
+            << std::endl;
+      Rcpp::Rcerr
+        << " *** Unless you are _sure_ this really is an old BED file *** "
+        << std::endl;
+      Rcpp::Rcerr << " *** you should recreate PED -> BED                      *** "
+            << std::endl
+            << std::endl;
+    }
+    bfile_SNP_major = false;
+    BIT.close();
+    BIT.clear();
+    BIT.open(s.c_str(), std::ios::in | std::ios::binary);
+  } else if (!v1_bfile) {
+    if (b[0])
+      bfile_SNP_major = true;
+    else
+      bfile_SNP_major = false;
+    if (!quiet) {
+      Rcpp::Rcerr << "Binary PED file is v0.99" << std::endl;
+      if (bfile_SNP_major)
+        Rcpp::Rcerr << "Detected that binary PED file is in SNP-major mode"
+              << std::endl;
+      else
+        Rcpp::Rcerr << "Detected that binary PED file is in individual-major mode"
+              << std::endl;
+    }
+  }
+  return bfile_SNP_major;
+}
+
+// The SNPs kept by readGenotypes, which drops the SNPs of zero variance and
+// those below a minor allele frequency or call rate: the position, among the
+// SNPs read, of each SNP kept and of each SNP of zero variance (the others are
+// left out of the model altogether), and the standard deviation of every SNP
+struct SnpFilter {
+  double maf;          // minimum minor allele frequency
+  double callrate;     // minimum proportion of non missing genotypes
+  arma::uvec kept;
+  arma::uvec constant;
+  arma::vec sd;
+
+  SnpFilter(double maf = 0.0, double callrate = 0.0) : maf(maf), callrate(callrate) {}
+};
+
+// The body of genotypeMatrix. When filter is not NULL, only the columns of
+// the SNPs it keeps are returned. The genotypes are stored as T. When abort
+// is not NULL, readGenotypes does not call R, so that it can run on a thread
+// of its own (the warnings of openPlinkBinaryFile are then not printed), and
+// stops early once abort is set.
+template <class T = double>
+inline arma::Mat<T> readGenotypes(const std::string fileName, int N, int P,
+                               arma::Col<int> col_skip_pos, arma::Col<int> col_skip,
+                               arma::Col<int> keepbytes, arma::Col<int> keepoffset,
+                               const int fillmissing, SnpFilter* filter,
+                               const std::atomic<bool>* abort = NULL) {
+
+  std::ifstream bedFile;
+  bool snpMajor = openPlinkBinaryFile(fileName, bedFile, abort != NULL);
+
+  if (!snpMajor)
+    throw std::runtime_error("We currently have no plans of implementing the "
+                               "individual-major mode. Please use the snp-major "
+                               "format");
+
+  int i = 0;
+  int ii = 0;
+  const bool colskip = (col_skip_pos.n_elem > 0);
+  unsigned long long int Nbytes = ceil(N / 4.0);
+  const bool selectrow = (keepbytes.n_elem > 0);
+  int n, p, nskip;
+  if (selectrow)
+    n = keepbytes.n_elem;
+  else
+    n = N;
+
+  if (colskip) {
+    nskip = arma::accu(col_skip);
+    p = P - nskip;
+  }  else
+    p = P;
+
+  int j, jj, iii, missing, nread;
+
+  arma::Mat<T> genotypes = arma::Mat<T>(n, p, arma::fill::zeros);
+  std::bitset<8> b; // Initiate the bit array
+  char ch[Nbytes];
+
+  iii=0;
+  nread=0;
+  std::vector<arma::uword> kept, constant;
+  if (filter != NULL) filter->sd.set_size(p);
+  while (i < P) {
+    // Rcout << i << std::endl;
+    if (abort == NULL) Rcpp::checkUserInterrupt();
+    else if (abort->load()) break;
+    if (colskip) {
+      if (ii < col_skip.n_elem) {
+        if (i == col_skip_pos[ii]) {
+          bedFile.seekg(col_skip[ii] * Nbytes, bedFile.cur);
+          i = i + col_skip[ii];
+          ii++;
+          continue;
+        }
+      }
+    }
+
+    bedFile.read(ch, Nbytes); // Read the information
+    if (!bedFile)
+      throw std::runtime_error(
+          "Problem with the BED file...has the FAM/BIM file been changed?");
+
+    j = 0;
+    missing = 0;
+    if (!selectrow) {
+      for (jj = 0; jj < Nbytes; jj++) {
+        b = ch[jj];
+
+        int c = 0;
+        while (c < 7 &&
+               j < N) { // from the original PLINK: 7 because of 8 bits
+          int first = b[c++];
+          int second = b[c++];
+          if (first == 0) {
+            genotypes(j, iii) = (2 - second);
+          }
+          if(first == 1 && second == 0) missing++;
+          if(fillmissing == 0 && first == 1 && second == 0) genotypes(j, iii) =arma::datum::nan;
+          j++;
+        }
+      }
+    } else {
+      for (jj = 0; jj < keepbytes.n_elem; jj++) {
+        b = ch[keepbytes[jj]];
+
+        int c = keepoffset[jj];
+        int first = b[c++];
+        int second = b[c];
+        if (first == 0) {
+          genotypes(j, iii) = (2 - second);
+        }
+        if(first == 1 && second == 0) missing++;
+        if(fillmissing == 0 && first == 1 && second == 0) genotypes(j, iii) =arma::datum::nan;
+        j++;
+      }
+    }
+    i++;
+    if (filter == NULL) {
+      iii++;
+      continue;
+    }
+
+    // The SNP is dropped if its call rate or minor allele frequency are too low,
+    // and its column is reused for the next SNP unless it varies
+    arma::Col<T> g(genotypes.colptr(iii), n, false, true);
+    double dosage = 0.0;
+    for (j = 0; j < n; j++) {
+      if (!std::isnan(g(j))) dosage += g(j);
+    }
+    double freq = (missing < n) ? dosage / (2.0 * (n - missing)) : 0.0;
+    filter->sd(nread) = arma::stddev(g);
+    bool varies = false;
+    if (n - missing >= filter->callrate * n && std::min(freq, 1.0 - freq) >= filter->maf) {
+      varies = (filter->sd(nread) != 0.0);
+      if (varies) kept.push_back(nread);
+      else constant.push_back(nread);
+    }
+    if (varies) iii++;
+    else g.zeros();
+    nread++;
+  }
+
+  if (filter != NULL) {
+    genotypes.resize(n, iii);
+    filter->kept = arma::uvec(kept.size());
+    filter->constant = arma::uvec(constant.size());
+    std::copy(kept.begin(), kept.end(), filter->kept.begin());
+    std::copy(constant.begin(), constant.end(), filter->constant.begin());
+  }
+  return genotypes;
+}
+
+// The body of normalize, for genotypes stored as T
+template <class T>
+inline arma::vec normalizeColumns(arma::Mat<T> &genotypes)
+{
+  int k = genotypes.n_cols;
+  int n = genotypes.n_rows;
+  arma::vec sd(k);
+  for (int i = 0; i < k; ++i) {
+    T m = arma::mean(genotypes.col(i));
+    arma::Col<T> mm(n); mm.fill(m);
+    sd(i) = arma::stddev(genotypes.col(i));
+    // sd(i) = 1.0;
+    genotypes.col(i) = arma::normalise(genotypes.col(i) - mm);
+  }
+  return sd;
+}
+
+// The body of multiBed3spInput: the nonzero betas of beta, a (p*q) x nlambda
+// sparse matrix, SNP by SNP, their number for each SNP, and their column in
+// the result of multiBed3sp, l*q+k for trait k and lambda l (0-based)
+inline Rcpp::List sparseBetaInput(const arma::sp_mat& beta, int q) {
+  int p = beta.n_rows / q;
+  arma::Col<int> nonzeros(p, arma::fill::zeros);
+  arma::Col<int> first(p + 1, arma::fill::zeros);
+  arma::vec values(beta.n_nonzero);
+  arma::Col<int> colpos(beta.n_nonzero);
+  int j, c;
+  unsigned int k;
+
+  // beta is stored column by column: count the nonzero betas of each SNP, then
+  // place each one after those of the previous SNPs
+  for(k=0; k < beta.n_nonzero; k++) nonzeros(beta.row_indices[k] / q)++;
+  for(j=0; j < p; j++) first(j+1) = first(j) + nonzeros(j);
+  for(c=0; c < beta.n_cols; c++) {
+    for(k=beta.col_ptrs[c]; k < beta.col_ptrs[c+1]; k++) {
+      int row = beta.row_indices[k];
+      int pos = first(row / q)++;
+      values(pos) = beta.values[k];
+      colpos(pos) = c*q + row % q;
+    }
+  }
+
+  return Rcpp::List::create(Rcpp::Named("beta") = values,
+                            Rcpp::Named("nonzeros") = nonzeros,
+                            Rcpp::Named("colpos") = colpos,
+                            Rcpp::Named("ncol") = (int) beta.n_cols*q);
+}
+
+#endif // LASSOSUM_PLINK_BED_H
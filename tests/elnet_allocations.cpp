@@ -0,0 +1,156 @@
+/**
+   lassosum
+   elnet_allocations.cpp
+   Purpose: check that solvePath allocates nothing from one lambda to the next
+
+   The heap allocations are counted, those of the std containers by the
+   operator new below and those of armadillo's matrices through
+   ARMA_ALIEN_MEM_ALLOC_FUNCTION. For every engine of solvePath, a path of
+   6 lambdas must allocate exactly as much as one of 2: everything solvePath
+   needs is set up once per path. FISTA, which solves every lambda at once,
+   must moreover allocate as much for 6 blocks as for 3, its scratch space
+   being kept per thread rather than allocated for each block. solvePath runs
+   on one thread (shotgunCore would otherwise start its threads for each
+   block) and with an abort flag, so that nothing calls R.
+
+   It is not run by R CMD check: run_elnet_allocations.sh builds it against
+   the Rcpp and RcppArmadillo of the R installation and runs it.
+
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<long> allocations(0);
+
+static void* countedMalloc(std::size_t n)
+{
+  allocations++;
+  return std::malloc(n);
+}
+
+#define ARMA_ALIEN_MEM_ALLOC_FUNCTION countedMalloc
+#define ARMA_ALIEN_MEM_FREE_FUNCTION std::free
+
+#include "../.C/functions_mixed_model.cpp"
+
+void* operator new(std::size_t n)
+{
+  void* p = countedMalloc(n == 0 ? 1 : n);
+  if(p == NULL) throw std::bad_alloc();
+  return p;
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+// The engines of solvePath, each set up as by runElnet
+enum Engine { CD, FISTA, LOWRANK, LDCOLUMNS, SHOTGUN, BAND, SINGLE, NENGINES };
+static const char* engineNames[NENGINES] = {"cd", "fista", "lowrank", "ldcolumns", "shotgun",
+                                            "band", "single"};
+
+// The allocations of solvePath on nl lambdas with engine, on the SNPs of G
+// (Gf in single precision) cut into nblocks blocks
+static long pathAllocations(arma::mat& G, const arma::fmat& Gf, const arma::mat& cor,
+                            const arma::mat& Sb, const arma::mat& Ss, int engine, int nblocks,
+                            int nl)
+{
+  int q = Sb.n_cols;
+  int p = G.n_cols;
+  SnpFilter filter;
+  filter.kept.set_size(p);
+  for(int j=0; j < p; j++) filter.kept(j) = j;
+  filter.sd.set_size(p);
+  filter.sd.fill(1.0);
+  arma::mat init(q, p, arma::fill::zeros);
+  arma::Col<int> startvec(nblocks), endvec(nblocks);
+  for(int b=0; b < nblocks; b++) {
+    startvec(b) = q * (b * p / nblocks);
+    endvec(b) = q * ((b + 1) * p / nblocks) - 1;
+  }
+  int code = (engine == FISTA) ? 1 : ((engine == LDCOLUMNS) ? 3 : 0);
+  ElnetProblem<MixedModel> pb = elnetProblem(MixedModel(Sb, Ss), cor, init, filter, startvec,
+                                             endvec, code, 1000, G.n_rows, 4e9);
+  if(engine == SHOTGUN) shotgunProblem(pb, G, 1, 200, 0.1, 1);
+  if(engine == LOWRANK) lowrankFactors(pb, G, 0.9, 1);
+  if(engine == LDCOLUMNS) ldColumnsProblem(pb, G, 4e9);
+  if(engine == BAND) {
+    arma::Col<int> windowend(p);
+    for(int j=0; j < p; j++) windowend(j) = std::min(j + 10, p - 1);
+    bandProblem(pb, G, windowend, 0.0, 1);
+  }
+  if(engine == SINGLE) singleProblem(pb, Gf, true);
+  // En simple précision, G n'a pas de colonnes (voir runElnet)
+  arma::mat Gsingle(G.n_rows, 0);
+  arma::mat& Guse = (engine == SINGLE) ? Gsingle : G;
+
+  std::vector<ElnetWorkspace> ws = elnetWorkspaces(pb.startvec, pb.endvec, G.n_rows * q, 1, 0);
+  arma::vec lambda(nl);
+  for(int l=0; l < nl; l++) lambda(l) = 0.1 * std::pow(0.4, l);
+  std::atomic<bool> abort(false);
+  ElnetPath path;
+
+  long before = allocations.load();
+  solvePath(pb, Guse, lambda, 0.5, false, 1e-7, 0, 10000, 1, ElnetControl(1, 0, 0.0, false),
+            false, true, ws, path, &abort);
+  long n = allocations.load() - before;
+  if(arma::accu(path.out) != nl) {
+    std::printf("%s: the path did not converge\n", engineNames[engine]);
+    std::exit(1);
+  }
+  return n;
+}
+
+int main()
+{
+  int n = 80, p = 120, q = 2;
+  std::mt19937 rng(1);
+  std::normal_distribution<double> normal(0.0, 1.0);
+
+  // Standardized genotypes: columns of mean 0 and norm 1
+  arma::mat G(n, p);
+  for(int j=0; j < p; j++) {
+    double mean = 0.0, norm = 0.0;
+    for(int s=0; s < n; s++) {
+      G(s,j) = normal(rng);
+      mean += G(s,j) / n;
+    }
+    for(int s=0; s < n; s++) {
+      G(s,j) -= mean;
+      norm += G(s,j) * G(s,j);
+    }
+    for(int s=0; s < n; s++) G(s,j) /= std::sqrt(norm);
+  }
+  arma::fmat Gf(n, p);
+  for(int j=0; j < p; j++)
+    for(int s=0; s < n; s++) Gf(s,j) = (float) G(s,j);
+
+  // The correlations of q traits with a few causal SNPs
+  arma::mat cor(q, p);
+  for(int j=0; j < p; j++)
+    for(int k=0; k < q; k++) cor(k,j) = 0.05 * normal(rng);
+  cor(0,3) = 0.4; cor(0,17) = -0.2; cor(1,17) = 0.3; cor(1,25) = 0.15; cor(0,90) = 0.25;
+
+  int failed = 0;
+  for(int diagonal=0; diagonal < 2; diagonal++) {
+    arma::mat Sb(q, q), Ss(q, q, arma::fill::zeros);
+    Sb(0,0) = 2.0; Sb(1,1) = 1.5;
+    Sb(0,1) = Sb(1,0) = diagonal ? 0.0 : 0.4;
+    Ss(0,0) = 1.2; Ss(1,1) = 0.8;
+    for(int engine=0; engine < NENGINES; engine++) {
+      long short_path = pathAllocations(G, Gf, cor, Sb, Ss, engine, 3, 2);
+      long long_path = pathAllocations(G, Gf, cor, Sb, Ss, engine, 3, 6);
+      std::printf("%s, inv_Sb %s: %ld allocations for 2 lambdas, %ld for 6\n",
+                  engineNames[engine], diagonal ? "diagonal" : "full", short_path, long_path);
+      if(short_path != long_path) failed = 1;
+      if(engine == FISTA) {
+        long more_blocks = pathAllocations(G, Gf, cor, Sb, Ss, engine, 6, 2);
+        std::printf("%s, inv_Sb %s: %ld allocations for 3 blocks, %ld for 6\n",
+                    engineNames[engine], diagonal ? "diagonal" : "full", short_path, more_blocks);
+        if(short_path != more_blocks) failed = 1;
+      }
+    }
+  }
+  return failed;
+}
@@ -0,0 +1,19 @@
+#!/bin/sh
+# Builds elnet_allocations.cpp against the Rcpp and RcppArmadillo of the R
+# installation and runs it: exits with 1 if a path of solvePath allocates
+# from one lambda to the next. R CMD check does not run it.
+
+set -e
+cd "$(dirname "$0")"
+CXX=$(R CMD config CXX11)
+CXXFLAGS=$(R CMD config CXX11FLAGS)
+CPPFLAGS="$(R CMD config --cppflags) \
+  -I$(Rscript -e 'cat(system.file("include", package="Rcpp"))') \
+  -I$(Rscript -e 'cat(system.file("include", package="RcppArmadillo"))')"
+LIBS="$(R CMD config --ldflags) $(R CMD config LAPACK_LIBS) $(R CMD config BLAS_LIBS)"
+OUT=$(mktemp)
+$CXX $CXXFLAGS $CPPFLAGS -pthread elnet_allocations.cpp -o "$OUT" $LIBS
+STATUS=0
+"$OUT" || STATUS=$?
+rm -f "$OUT"
+exit $STATUS